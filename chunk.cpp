@@ -0,0 +1,17 @@
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <iterator>
+
+#include "token.hpp"
+
+#include "chunk.hpp"
+
+const Token& Chunk::tokenAt(std::size_t offset) const {
+  assert(!tokens.empty());
+  auto it = std::upper_bound(
+      tokens.cbegin(), tokens.cend(), offset,
+      [](std::size_t off, const auto& entry) { return off < entry.first; });
+  assert(it != tokens.cbegin());
+  return *std::prev(it)->second;
+}
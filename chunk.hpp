@@ -0,0 +1,108 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "functional.hpp"
+#include "ltype.hpp"
+#include "property_cache.hpp"
+#include "stmt_fwd.hpp"
+#include "symbol.hpp"
+#include "token.hpp"
+
+// operands follow the opcode. idx and jump operands are 16 bits wide,
+// little-endian, argc and flags are a single byte
+enum class Op : std::uint8_t {
+  // idx into constants
+  CONSTANT,
+  NIL,
+  POP,
+
+  // idx of the slot, cell or upvalue. GET_* push, SET_* assign the top
+  // without popping it
+  GET_LOCAL,
+  SET_LOCAL,
+  GET_CELL,
+  SET_CELL,
+  GET_UPVALUE,
+  SET_UPVALUE,
+  // idx into names
+  GET_GLOBAL,
+  SET_GLOBAL,
+  // declare an uninitialized variable, which is then set with SET_*
+  DECLARE_LOCAL,
+  DECLARE_CELL,
+  DECLARE_GLOBAL,
+
+  ADD,
+  SUBTRACT,
+  MULTIPLY,
+  DIVIDE,
+  MODULO,
+  EQUAL,
+  NOT_EQUAL,
+  LESS,
+  LESS_EQUAL,
+  GREATER,
+  GREATER_EQUAL,
+  NEGATE,
+  NOT,
+
+  PRINT,
+
+  // jump offsets are relative to the next instruction
+  JUMP,
+  // pops the condition
+  JUMP_IF_FALSE,
+  // keeps the condition if jumping, pops it otherwise
+  JUMP_IF_FALSE_OR_POP,
+  JUMP_IF_TRUE_OR_POP,
+  // backwards
+  LOOP,
+
+  // argc, checks the callee below the arguments still to be evaluated
+  CHECK_CALL,
+  // argc
+  CALL,
+  // idx into names, idx into caches. Replaces the object on top by its
+  // method and pushes the object, or by the property and pushes nil
+  GET_METHOD,
+  // argc, checks what GET_METHOD left below the arguments still to be
+  // evaluated
+  CHECK_INVOKE,
+  // argc, calls the method on the object below the arguments, or the
+  // property
+  INVOKE,
+  RETURN,
+  // idx into functions
+  CLOSURE,
+  // idx into classes, with the superclass on top if it has one
+  CLASS,
+  // idx into names, idx into caches
+  GET_PROPERTY,
+  // before evaluating the value to assign
+  CHECK_INSTANCE,
+  // idx into names, idx into caches
+  SET_PROPERTY,
+  // whether 'this' is on top, above the superclass
+  GET_SUPER
+};
+
+// the bytecode of a function body, or of the top level
+struct Chunk {
+  std::vector<std::uint8_t> code;
+  std::vector<Ltype> constants;
+  std::vector<Symbol> names;
+  std::vector<std::shared_ptr<const Functional>> functions;
+  std::vector<const StmtClass*> classes;
+  // of the sites accessing properties, filled in while running
+  mutable std::vector<PropertyCache> caches;
+  // for runtime errors, the token of the node each run of code starting at
+  // the offset was compiled from. Tokens live in the AST, which outlives
+  // the chunk
+  std::vector<std::pair<std::size_t, const Token*>> tokens;
+
+  const Token& tokenAt(std::size_t offset) const;
+};
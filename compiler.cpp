@@ -0,0 +1,493 @@
+#include <cstdint>
+#include <limits>
+#include <list>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "assert.hpp"
+#include "chunk.hpp"
+#include "expr.hpp"
+#include "interp.hpp"
+#include "ltype.hpp"
+#include "stmt.hpp"
+#include "token.hpp"
+
+#include "compiler.hpp"
+
+using enum Token::Type;
+
+Compiler::Compiler() : chunkp(nullptr), loops{}, lastToken(nullptr) {}
+
+std::unique_ptr<const Chunk> Compiler::compileScript(
+    const std::list<std::shared_ptr<const Stmt>>& list) {
+  auto chunk = std::make_unique<Chunk>();
+
+  chunkp = chunk.get();
+  compile(list);
+  emit(Op::NIL);
+  emit(Op::RETURN);
+  chunkp = nullptr;
+  return chunk;
+}
+
+void Compiler::compileFunction(const Functional& fun) {
+  Chunk* save;
+  std::vector<Loop> saveLoops;
+  auto chunk = std::make_unique<Chunk>();
+
+  save = chunkp;
+  saveLoops = std::move(loops);
+  loops.clear();
+  chunkp = chunk.get();
+  compile(fun.listp->stmts);
+  // implicitly return nil by default, in case of no return statement
+  emit(Op::NIL);
+  emit(Op::RETURN);
+  fun.chunk = std::move(chunk);
+  chunkp = save;
+  loops = std::move(saveLoops);
+}
+
+void Compiler::compile(std::shared_ptr<const Expr> expr) {
+  expr->accept(*this);
+}
+
+void Compiler::compile(const Stmt& stmt) {
+  stmt.accept(*this);
+}
+
+void Compiler::compile(const std::list<std::shared_ptr<const Stmt>>& list) {
+  for (const auto& ptr : list)
+    compile(*ptr);
+}
+
+void Compiler::emit(Op op) {
+  chunkp->code.push_back(static_cast<std::uint8_t>(op));
+}
+
+void Compiler::emit(const Token& token, Op op) {
+  if (chunkp->tokens.empty() || chunkp->tokens.back().second != &token)
+    chunkp->tokens.emplace_back(chunkp->code.size(), &token);
+  lastToken = &token;
+  emit(op);
+}
+
+void Compiler::emitByte(std::size_t byte) {
+  chunkp->code.push_back(static_cast<std::uint8_t>(byte));
+}
+
+void Compiler::emitShort(std::size_t value) {
+  if (value > std::numeric_limits<std::uint16_t>::max())
+    error("chunk too large");
+  emitByte(value & 0xff);
+  emitByte((value >> 8) & 0xff);
+}
+
+std::size_t Compiler::emitJump(Op op) {
+  emit(op);
+  emitShort(0);
+  return chunkp->code.size() - 2;
+}
+
+void Compiler::patchJump(std::size_t offset) {
+  std::size_t jump;
+
+  // relative to the end of the operand
+  jump = chunkp->code.size() - offset - 2;
+  if (jump > std::numeric_limits<std::uint16_t>::max())
+    error("too much code to jump over");
+  chunkp->code[offset] = static_cast<std::uint8_t>(jump & 0xff);
+  chunkp->code[offset + 1] = static_cast<std::uint8_t>((jump >> 8) & 0xff);
+}
+
+void Compiler::emitLoop(std::size_t start) {
+  emit(Op::LOOP);
+  // past the operand
+  emitShort(chunkp->code.size() + 2 - start);
+}
+
+void Compiler::error(std::string msg) {
+  if (lastToken != nullptr)
+    Interp::error(*lastToken, msg);
+  else
+    Interp::error(0, msg);
+}
+
+std::size_t Compiler::addConstant(Ltype value) {
+  chunkp->constants.push_back(value);
+  return chunkp->constants.size() - 1;
+}
+
+std::size_t Compiler::addName(Symbol name) {
+  std::size_t i;
+
+  for (i = 0; i < chunkp->names.size(); i++) {
+    if (chunkp->names[i] == name)
+      return i;
+  }
+  chunkp->names.push_back(name);
+  return i;
+}
+
+std::size_t Compiler::addFunction(std::shared_ptr<const Functional> funp) {
+  chunkp->functions.push_back(funp);
+  return chunkp->functions.size() - 1;
+}
+
+std::size_t Compiler::addCache() {
+  chunkp->caches.emplace_back();
+  return chunkp->caches.size() - 1;
+}
+
+void Compiler::getVariable(const Token& token,
+                           const std::optional<Local>& local) {
+  if (!local.has_value()) {
+    emit(token, Op::GET_GLOBAL);
+    emitShort(addName(token.symbol));
+    return;
+  }
+  if (local->isUpvalue)
+    emit(token, Op::GET_UPVALUE);
+  else if (local->isBoxed)
+    emit(token, Op::GET_CELL);
+  else
+    emit(token, Op::GET_LOCAL);
+  emitShort(local->index);
+}
+
+void Compiler::setVariable(const Token& token,
+                           const std::optional<Local>& local) {
+  if (!local.has_value()) {
+    emit(token, Op::SET_GLOBAL);
+    emitShort(addName(token.symbol));
+    return;
+  }
+  if (local->isUpvalue)
+    emit(token, Op::SET_UPVALUE);
+  else if (local->isBoxed)
+    emit(token, Op::SET_CELL);
+  else
+    emit(token, Op::SET_LOCAL);
+  emitShort(local->index);
+}
+
+void Compiler::declareVariable(const Token& token,
+                               const std::optional<Local>& local) {
+  if (!local.has_value()) {
+    emit(token, Op::DECLARE_GLOBAL);
+    emitShort(addName(token.symbol));
+    return;
+  }
+  emit(token, local->isBoxed ? Op::DECLARE_CELL : Op::DECLARE_LOCAL);
+  emitShort(local->index);
+}
+
+Ltype Compiler::visit(const ExprBinary* expr) {
+  Op op;
+
+  compile(expr->left);
+  compile(expr->right);
+  switch (expr->oper.type) {
+    case MINUS:
+      op = Op::SUBTRACT;
+      break;
+    case STAR:
+      op = Op::MULTIPLY;
+      break;
+    case SLASH:
+      op = Op::DIVIDE;
+      break;
+    case PERCENT:
+      op = Op::MODULO;
+      break;
+    case PLUS:
+      op = Op::ADD;
+      break;
+    case EQUAL_EQUAL:
+      op = Op::EQUAL;
+      break;
+    case BANG_EQUAL:
+      op = Op::NOT_EQUAL;
+      break;
+    case LESS:
+      op = Op::LESS;
+      break;
+    case LESS_EQUAL:
+      op = Op::LESS_EQUAL;
+      break;
+    case GREATER:
+      op = Op::GREATER;
+      break;
+    case GREATER_EQUAL:
+      op = Op::GREATER_EQUAL;
+      break;
+    default:
+      myAssert(expr->oper, "unhandled binary operator");
+      return Lnil();
+  }
+  emit(expr->oper, op);
+  return Lnil();
+}
+
+Ltype Compiler::visit(const ExprComma* expr) {
+  compile(expr->left);
+  emit(Op::POP);
+  compile(expr->right);
+  return Lnil();
+}
+
+Ltype Compiler::visit(const ExprLogical* expr) {
+  std::size_t end;
+
+  compile(expr->left);
+  switch (expr->oper.type) {
+    case OR:
+      end = emitJump(Op::JUMP_IF_TRUE_OR_POP);
+      break;
+    case AND:
+      end = emitJump(Op::JUMP_IF_FALSE_OR_POP);
+      break;
+    default:
+      myAssert(expr->oper, "unhandled logical operator");
+      return Lnil();
+  }
+  compile(expr->right);
+  patchJump(end);
+  return Lnil();
+}
+
+Ltype Compiler::visit(const ExprGrouping* expr) {
+  compile(expr->exprp);
+  return Lnil();
+}
+
+Ltype Compiler::visit(const ExprLiteral* expr) {
+  if (expr->value.is<Lnil>()) {
+    emit(Op::NIL);
+  } else {
+    emit(Op::CONSTANT);
+    emitShort(addConstant(expr->value));
+  }
+  return Lnil();
+}
+
+Ltype Compiler::visit(const ExprUnary* expr) {
+  compile(expr->exprp);
+  switch (expr->oper.type) {
+    case MINUS:
+      emit(expr->oper, Op::NEGATE);
+      break;
+    case BANG:
+      emit(expr->oper, Op::NOT);
+      break;
+    default:
+      myAssert(expr->oper, "unhandled unary operator");
+      break;
+  }
+  return Lnil();
+}
+
+Ltype Compiler::visit(const ExprTern* expr) {
+  std::size_t elseJump, endJump;
+
+  compile(expr->cond);
+  elseJump = emitJump(Op::JUMP_IF_FALSE);
+  compile(expr->thenp);
+  endJump = emitJump(Op::JUMP);
+  patchJump(elseJump);
+  compile(expr->elsep);
+  patchJump(endJump);
+  return Lnil();
+}
+
+Ltype Compiler::visit(const ExprVar* expr) {
+  getVariable(expr->token, expr->local);
+  return Lnil();
+}
+
+Ltype Compiler::visit(const ExprAssign* expr) {
+  compile(expr->exprp);
+  setVariable(expr->token, expr->local);
+  return Lnil();
+}
+
+Ltype Compiler::visit(const ExprCall* expr) {
+  if (const ExprGet* get = expr->method) {
+    // obj.m(args) calls m on obj without binding it
+    compile(get->exprp);
+    emit(get->token, Op::GET_METHOD);
+    emitShort(addName(get->token.symbol));
+    emitShort(addCache());
+    emit(expr->savedParen, Op::CHECK_INVOKE);
+    emitByte(expr->args.size());
+    for (const auto& ptr : expr->args)
+      compile(ptr);
+    emit(expr->savedParen, Op::INVOKE);
+    emitByte(expr->args.size());
+    return Lnil();
+  }
+  compile(expr->exprp);
+  // the callee is checked before evaluating the arguments
+  emit(expr->savedParen, Op::CHECK_CALL);
+  emitByte(expr->args.size());
+  for (const auto& ptr : expr->args)
+    compile(ptr);
+  emit(expr->savedParen, Op::CALL);
+  emitByte(expr->args.size());
+  return Lnil();
+}
+
+Ltype Compiler::visit(const ExprGet* expr) {
+  compile(expr->exprp);
+  emit(expr->token, Op::GET_PROPERTY);
+  emitShort(addName(expr->token.symbol));
+  emitShort(addCache());
+  return Lnil();
+}
+
+Ltype Compiler::visit(const ExprSet* expr) {
+  compile(expr->get->exprp);
+  // the object is checked before evaluating the value
+  emit(expr->token, Op::CHECK_INSTANCE);
+  compile(expr->exprp);
+  emit(expr->token, Op::SET_PROPERTY);
+  emitShort(addName(expr->token.symbol));
+  emitShort(addCache());
+  return Lnil();
+}
+
+Ltype Compiler::visit(const ExprThis* expr) {
+  getVariable(expr->token, expr->local);
+  return Lnil();
+}
+
+Ltype Compiler::visit(const ExprSuper* expr) {
+  getVariable(expr->token, expr->local);
+  if (expr->thisLocal.has_value())
+    getVariable(expr->token, expr->thisLocal);
+  emit(expr->method, Op::GET_SUPER);
+  emitByte(expr->thisLocal.has_value());
+  return Lnil();
+}
+
+Ltype Compiler::visit(std::shared_ptr<const ExprFun> expr) {
+  compileFunction(*expr);
+  emit(Op::CLOSURE);
+  emitShort(addFunction(expr));
+  return Lnil();
+}
+
+void Compiler::visit(const StmtExpr& stmt) {
+  compile(stmt.exprp);
+  emit(Op::POP);
+}
+
+void Compiler::visit(const StmtPrint& stmt) {
+  compile(stmt.exprp);
+  emit(Op::PRINT);
+}
+
+void Compiler::visit(const StmtVar& stmt) {
+  // uninitialized before evaluating the initializer, as in Interp
+  declareVariable(stmt.token, stmt.local);
+  if (stmt.exprp != nullptr) {
+    compile(stmt.exprp);
+    setVariable(stmt.token, stmt.local);
+    emit(Op::POP);
+  }
+}
+
+void Compiler::visit(const StmtLoop& stmt) {
+  std::size_t start, exit;
+
+  loops.push_back(Loop{});
+  start = chunkp->code.size();
+  compile(stmt.condp);
+  exit = emitJump(Op::JUMP_IF_FALSE);
+  compile(*stmt.body);
+  for (std::size_t offset : loops.back().continues)
+    patchJump(offset);
+  if (stmt.exprp != nullptr) {
+    compile(stmt.exprp);
+    emit(Op::POP);
+  }
+  emitLoop(start);
+  patchJump(exit);
+  for (std::size_t offset : loops.back().breaks)
+    patchJump(offset);
+  loops.pop_back();
+}
+
+void Compiler::visit(const StmtIf& stmt) {
+  std::size_t elseJump, endJump;
+
+  compile(stmt.condp);
+  elseJump = emitJump(Op::JUMP_IF_FALSE);
+  compile(*stmt.thenBranch);
+  if (stmt.elseBranch == nullptr) {
+    patchJump(elseJump);
+    return;
+  }
+  endJump = emitJump(Op::JUMP);
+  patchJump(elseJump);
+  compile(*stmt.elseBranch);
+  patchJump(endJump);
+}
+
+void Compiler::visit(const StmtList& stmt) {
+  // a scope only exists in the slot layout
+  compile(stmt.stmts);
+}
+
+void Compiler::visit(const StmtReturn& stmt) {
+  if (stmt.exprp != nullptr)
+    compile(stmt.exprp);
+  else
+    emit(Op::NIL);
+  emit(stmt.token, Op::RETURN);
+}
+
+void Compiler::visit(const StmtLoopFlow& stmt) {
+  switch (stmt.token.type) {
+    case BREAK:
+      loops.back().breaks.push_back(emitJump(Op::JUMP));
+      break;
+    case CONTINUE:
+      loops.back().continues.push_back(emitJump(Op::JUMP));
+      break;
+    default:
+      myAssert(stmt.token, "unhandled loop flow control statement");
+      break;
+  }
+}
+
+void Compiler::visit(std::shared_ptr<const StmtFun> stmtp) {
+  compileFunction(*stmtp);
+  // declared first, so a local function can capture itself
+  declareVariable(stmtp->token, stmtp->local);
+  emit(Op::CLOSURE);
+  emitShort(addFunction(stmtp));
+  setVariable(stmtp->token, stmtp->local);
+  emit(Op::POP);
+}
+
+void Compiler::visit(const StmtClass& stmt) {
+  if (stmt.ctor != nullptr)
+    compileFunction(*stmt.ctor);
+  for (const auto& ptr : stmt.methods)
+    compileFunction(*ptr);
+  for (const auto& ptr : stmt.staticMethods)
+    compileFunction(*ptr);
+
+  // the rest is done by Interp::defineClass, shared with the AST backend
+  if (stmt.local.has_value())
+    declareVariable(stmt.token, stmt.local);
+  if (stmt.superExpr != nullptr)
+    compile(stmt.superExpr);
+  emit(stmt.token, Op::CLASS);
+  chunkp->classes.push_back(&stmt);
+  emitShort(chunkp->classes.size() - 1);
+}
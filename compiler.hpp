@@ -0,0 +1,94 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "chunk.hpp"
+#include "expr_fwd.hpp"
+#include "expr_visitor.hpp"
+#include "functional.hpp"
+#include "local.hpp"
+#include "ltype.hpp"
+#include "stmt_visitor.hpp"
+#include "token.hpp"
+
+// compiles a resolved AST to bytecode for Vm. Functions are compiled into
+// their own chunk, kept in their Functional
+class Compiler : public ExprVisitor, public StmtVisitor {
+ private:
+  void visit(const StmtExpr& stmt) final;
+  void visit(const StmtPrint& stmt) final;
+  void visit(const StmtVar& stmt) final;
+  void visit(const StmtLoop& stmt) final;
+  void visit(const StmtIf& stmt) final;
+  void visit(const StmtList& stmt) final;
+  void visit(const StmtReturn& stmt) final;
+  void visit(const StmtLoopFlow& stmt) final;
+  void visit(std::shared_ptr<const StmtFun> stmtp) final;
+  void visit(const StmtClass& stmt) final;
+
+  Ltype visit(const ExprBinary* expr) final;
+  Ltype visit(const ExprGrouping* expr) final;
+  Ltype visit(const ExprLiteral* expr) final;
+  Ltype visit(const ExprUnary* expr) final;
+  Ltype visit(const ExprTern* expr) final;
+  Ltype visit(const ExprVar* expr) final;
+  Ltype visit(const ExprAssign* expr) final;
+  Ltype visit(const ExprCall* expr) final;
+  Ltype visit(const ExprGet* expr) final;
+  Ltype visit(const ExprSet* expr) final;
+  Ltype visit(const ExprThis* expr) final;
+  Ltype visit(const ExprSuper* expr) final;
+  Ltype visit(const ExprComma* expr) final;
+  Ltype visit(const ExprLogical* expr) final;
+  Ltype visit(std::shared_ptr<const ExprFun> expr) final;
+
+  // pending jumps of the innermost loop
+  struct Loop {
+    std::vector<std::size_t> breaks;
+    std::vector<std::size_t> continues;
+  };
+
+  Chunk* chunkp;
+  // of the function being compiled
+  std::vector<Loop> loops;
+  // most recently recorded, for errors of the compiler itself
+  const Token* lastToken;
+
+  void compile(std::shared_ptr<const Expr> expr);
+  void compile(const Stmt& stmt);
+  void compile(const std::list<std::shared_ptr<const Stmt>>& list);
+  void compileFunction(const Functional& fun);
+
+  void emit(Op op);
+  // records token for runtime errors of op
+  void emit(const Token& token, Op op);
+  void emitByte(std::size_t byte);
+  void emitShort(std::size_t value);
+  // returns the offset of the operand to patch
+  std::size_t emitJump(Op op);
+  // to the end of the code
+  void patchJump(std::size_t offset);
+  void emitLoop(std::size_t start);
+  void error(std::string msg);
+
+  std::size_t addConstant(Ltype value);
+  std::size_t addName(Symbol name);
+  std::size_t addFunction(std::shared_ptr<const Functional> funp);
+  std::size_t addCache();
+
+  void getVariable(const Token& token, const std::optional<Local>& local);
+  void setVariable(const Token& token, const std::optional<Local>& local);
+  void declareVariable(const Token& token, const std::optional<Local>& local);
+
+ public:
+  // returns the chunk of the top level
+  std::unique_ptr<const Chunk> compileScript(
+      const std::list<std::shared_ptr<const Stmt>>& list);
+
+  Compiler();
+};
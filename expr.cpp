@@ -39,14 +39,14 @@ Ltype ExprTern::accept(ExprVisitor& v) const {
   return v.visit(this);
 }
 
-ExprVar::ExprVar(Token token) : token(token) {}
+ExprVar::ExprVar(Token token) : token(token), local(std::nullopt) {}
 
 Ltype ExprVar::accept(ExprVisitor& v) const {
   return v.visit(this);
 }
 
 ExprAssign::ExprAssign(Token token, std::shared_ptr<const Expr> exprp)
-    : token(token), exprp(exprp) {}
+    : token(token), exprp(exprp), local(std::nullopt) {}
 
 Ltype ExprAssign::accept(ExprVisitor& v) const {
   return v.visit(this);
@@ -55,14 +55,17 @@ Ltype ExprAssign::accept(ExprVisitor& v) const {
 ExprCall::ExprCall(std::shared_ptr<const Expr> exprp,
                    Token savedParen,
                    std::list<std::shared_ptr<const Expr>>&& args)
-    : exprp(exprp), savedParen(savedParen), args(std::move(args)) {}
+    : exprp(exprp),
+      savedParen(savedParen),
+      args(std::move(args)),
+      method(dynamic_cast<const ExprGet*>(exprp.get())) {}
 
 Ltype ExprCall::accept(ExprVisitor& v) const {
   return v.visit(this);
 }
 
 ExprGet::ExprGet(std::shared_ptr<const Expr> exprp, Token token)
-    : exprp(exprp), token(token) {}
+    : exprp(exprp), token(token), cache{} {}
 
 Ltype ExprGet::accept(ExprVisitor& v) const {
   return v.visit(this);
@@ -71,20 +74,23 @@ Ltype ExprGet::accept(ExprVisitor& v) const {
 ExprSet::ExprSet(std::shared_ptr<const ExprGet> get,
                  Token token,
                  std::shared_ptr<const Expr> exprp)
-    : get(get), token(token), exprp(exprp) {}
+    : get(get), token(token), exprp(exprp), cache{} {}
 
 Ltype ExprSet::accept(ExprVisitor& v) const {
   return v.visit(this);
 }
 
-ExprThis::ExprThis(Token token) : token(token) {}
+ExprThis::ExprThis(Token token) : token(token), local(std::nullopt) {}
 
 Ltype ExprThis::accept(ExprVisitor& v) const {
   return v.visit(this);
 }
 
 ExprSuper::ExprSuper(Token token, Token method)
-    : token(token), method(method) {}
+    : token(token),
+      method(method),
+      local(std::nullopt),
+      thisLocal(std::nullopt) {}
 
 Ltype ExprSuper::accept(ExprVisitor& v) const {
   return v.visit(this);
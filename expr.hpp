@@ -1,13 +1,18 @@
 #pragma once
 #include <list>
 #include <memory>
+#include <optional>
 
+#include "expr_fwd.hpp"
 #include "expr_visitor_fwd.hpp"
 #include "functional.hpp"
+#include "local.hpp"
 #include "ltype.hpp"
+#include "property_cache.hpp"
 #include "stmt_fwd.hpp"
 #include "token.hpp"
 #include "uncopyable.hpp"
+
 // for ExprFun only
 struct Expr : public Uncopyable, public std::enable_shared_from_this<Expr> {
   Expr() = default;
@@ -77,6 +82,8 @@ struct ExprTern : public Expr {
 
 struct ExprVar : public Expr {
   const Token token;
+  // filled in by Resolver
+  mutable std::optional<Local> local;
 
   ExprVar(Token token);
 
@@ -88,6 +95,8 @@ struct ExprVar : public Expr {
 struct ExprAssign : public Expr {
   const Token token;
   const std::shared_ptr<const Expr> exprp;
+  // filled in by Resolver
+  mutable std::optional<Local> local;
 
   ExprAssign(Token token, std::shared_ptr<const Expr> exprp);
 
@@ -100,6 +109,8 @@ struct ExprCall : public Expr {
   const std::shared_ptr<const Expr> exprp;
   const Token savedParen;
   const std::list<std::shared_ptr<const Expr>> args;
+  // exprp if a get, as obj.m(args) calls a method without binding it
+  const ExprGet* const method;
 
   ExprCall(std::shared_ptr<const Expr> exprp,
            Token savedParen,
@@ -113,6 +124,7 @@ struct ExprCall : public Expr {
 struct ExprGet : public Expr {
   const std::shared_ptr<const Expr> exprp;
   const Token token;
+  mutable PropertyCache cache;
 
   ExprGet(std::shared_ptr<const Expr> exprp, Token token);
 
@@ -125,6 +137,7 @@ struct ExprSet : public Expr {
   const std::shared_ptr<const ExprGet> get;
   const Token token;
   const std::shared_ptr<const Expr> exprp;
+  mutable PropertyCache cache;
 
   ExprSet(std::shared_ptr<const ExprGet> get,
           Token token,
@@ -137,6 +150,8 @@ struct ExprSet : public Expr {
 
 struct ExprThis : public Expr {
   const Token token;
+  // filled in by Resolver
+  mutable std::optional<Local> local;
 
   ExprThis(Token token);
 
@@ -148,6 +163,10 @@ struct ExprThis : public Expr {
 struct ExprSuper : public Expr {
   const Token token;
   const Token method;
+  // filled in by Resolver
+  mutable std::optional<Local> local;
+  // absent in static methods
+  mutable std::optional<Local> thisLocal;
 
   ExprSuper(Token token, Token method);
 
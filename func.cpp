@@ -1,14 +1,19 @@
+#include <cstddef>
+#include <cstdint>
 #include <ctime>
 #include <memory>
 #include <optional>
+#include <utility>
+#include <vector>
 
 #include "func.hpp"
 #include "interp.hpp"
 #include "ltype.hpp"
 // constructor for Token so ctors can return 'this'
 #include "functional.hpp"
-#include "runent.hpp"
+#include "stmt.hpp"
 #include "token.hpp"
+#include "vm.hpp"
 
 Func::Func(std::size_t arity) : arity(arity) {}
 
@@ -26,122 +31,167 @@ Ltype Clock::call(Interp& interp, const std::list<Ltype>& args) {
   return (double)std::clock() / CLOCKS_PER_SEC;
 }
 
+HeapSnapshot::HeapSnapshot() : Func(0) {}
+
+HeapSnapshot* HeapSnapshot::get() {
+  static HeapSnapshot s;
+
+  return &s;
+}
+
+Ltype HeapSnapshot::call(Interp& interp, const std::list<Ltype>& args) {
+  (void)args;
+  return interp.snapshot();
+}
+
 Lfunc::Lfunc(std::shared_ptr<const Functional> funp,
-             Interp::Env* enclosing,
+             std::vector<Interp::Cell*> upvalues,
+             Linstance* receiver,
              bool isCtor)
     : Func(funp->params.size()),
       funp(funp),
-      enclosing(enclosing),
+      upvalues(std::move(upvalues)),
+      receiver(receiver),
       isCtor(isCtor) {}
 
 Ltype Lfunc::call(Interp& interp, const std::list<Ltype>& args) {
-  Interp::Env* newEnv;
-  Ltype ret;
-
-  Interp::ReclaimerCtx ctx(interp);
+  return call(interp, receiver, args);
+}
 
-  // implicitly return nil by default, in case of no return statement
-  ret = Lnil();
+Ltype Lfunc::call(Interp& interp, const Ltype* args) {
+  return call(interp, receiver, args);
+}
 
-  newEnv = interp.alloc<Interp::Env>(ctx, enclosing);
+Ltype Lfunc::call(Interp& interp,
+                  Linstance* receiver,
+                  const std::list<Ltype>& args) {
+  Interp::Frame frame(interp, this, funp->nSlots);
 
   auto itArgs = args.cbegin();
   auto itArgsEnd = args.cend();
   auto itParams = funp->params.cbegin();
-  for (; itArgs != itArgsEnd; itParams++, itArgs++)
-    newEnv->def(*itParams, *itArgs);
-  try {
-    interp.execute(*funp->listp.get(), newEnv);
-  } catch (Interp::Return& exception) {
-    ret = exception.retVal;
+  auto itLocals = funp->paramLocals.cbegin();
+  for (; itArgs != itArgsEnd; itParams++, itArgs++, itLocals++)
+    interp.define(*itLocals, *itParams, *itArgs);
+  return body(interp, receiver);
+}
+
+Ltype Lfunc::call(Interp& interp, Linstance* receiver, const Ltype* args) {
+  std::size_t i;
+
+  Interp::Frame frame(interp, this, funp->nSlots);
+
+  auto itParams = funp->params.cbegin();
+  for (i = 0; i < arity; i++, itParams++)
+    interp.define(funp->paramLocals[i], *itParams, args[i]);
+  return body(interp, receiver);
+}
+
+Ltype Lfunc::body(Interp& interp, Linstance* receiver) {
+  static const Token self(Token::Type::THIS, "this", "", 0,
+                          Symbols::intern("this"));
+  Ltype ret;
+
+  if (funp->thisLocal.has_value())
+    interp.define(funp->thisLocal, self, receiver);
+
+  if (funp->chunk != nullptr) {
+    ret = Vm(interp).run(*funp->chunk);
+  } else {
+    // shares the scope of the parameters
+    interp.execute(*funp->listp.get());
+    ret = interp.returnValue();
   }
 
   if (isCtor)
-    ret = enclosing->getAt(Token(Token::Type::THIS, "this", "", 0), 0);
+    ret = receiver;
   return ret;
 }
 
 Lfunc* Lfunc::bind(Interp& interp, Linstance* inst) const {
-  Interp::Env* newEnv;
-  Lfunc* ptr;
-  Interp::ReclaimerCtx ctx(interp);
+  Interp::RootScope scope(interp);
 
-  newEnv = interp.alloc<Interp::Env>(ctx, enclosing);
   // bind as ctor if a ctor
-  ptr = interp.alloc<Lfunc>(ctx, funp, newEnv, isCtor);
-  newEnv->def(Token(Token::Type::THIS, "this", "", 0), inst);
-
-  return ptr;
+  return interp.alloc<Lfunc>(scope, funp, upvalues, inst, isCtor);
 }
 
-Lclass::Lclass(std::string name,
+static std::uint64_t lastClassId = 0;
+
+Lclass::Lclass(Symbol name,
                std::size_t ctorArity,
-               std::unordered_map<std::string, Lfunc*> methods,
-               std::unordered_map<std::string, Lfunc*> staticMethods,
-               Lclass* base,
-               Interp::Env* superEnv)
+               std::unordered_map<Symbol, Lfunc*> methods,
+               std::unordered_map<Symbol, Lfunc*> staticMethods,
+               Lclass* base)
     : Func(ctorArity),
       name(name),
-      methods(methods),
-      staticMethods(staticMethods),
-      base(base),
-      superEnv(superEnv) {}
+      id(++lastClassId),
+      methods(std::move(methods)),
+      staticMethods(std::move(staticMethods)),
+      base(base) {}
 
 // when called as class name
 Ltype Lclass::call(Interp& interp, const std::list<Ltype>& args) {
   Linstance* ptr;
-  Interp::ReclaimerCtx ctx(interp);
+  Interp::RootScope scope(interp);
 
-  ptr = interp.alloc<Linstance>(ctx, this);
+  ptr = interp.alloc<Linstance>(scope, this);
 
   auto it = methods.find(name);
   if (it != methods.end())
-    // bound
-    std::get<LfunPtr>(ctx.add(ptr->get(interp, name).value()))
-        ->call(interp, args);
+    it->second->call(interp, ptr, args);
 
   return ptr;
 }
 
-std::optional<Lfunc*> Lclass::get(
-    const std::unordered_map<std::string, Lfunc*>& table,
-    std::optional<Lfunc*> (Lclass::*getter)(std::string) const,
-    std::string name) const {
-  auto it = table.find(name);
-  if (it == table.end()) {
-    if (base == nullptr)
-      return std::nullopt;
-    return (base->*getter)(name);
-  }
+std::optional<Lfunc*> Lclass::getMethod(Symbol name) const {
+  auto it = methods.find(name);
+  if (it == methods.end())
+    return std::nullopt;
   return it->second;
 }
 
-std::optional<Lfunc*> Lclass::getMethod(std::string name) const {
-  return get(methods, &Lclass::getMethod, name);
-}
-
-std::optional<Lfunc*> Lclass::getStaticMethod(std::string name) const {
-  return get(staticMethods, &Lclass::getStaticMethod, name);
+std::optional<Lfunc*> Lclass::getStaticMethod(Symbol name) const {
+  auto it = staticMethods.find(name);
+  if (it == staticMethods.end())
+    return std::nullopt;
+  return it->second;
 }
 
-Linstance::Linstance(Lclass* lclass) : lclass(lclass), properties{} {}
+Linstance::Linstance(Lclass* lclass)
+    : lclass(lclass), shape(Shape::empty()), fields{}, moreFields{} {}
 
-std::optional<Ltype> Linstance::get(Interp& interp, std::string name) {
+std::optional<Ltype> Linstance::get(Interp& interp, Symbol name) {
+  std::optional<std::size_t> index;
   std::optional<Lfunc*> ret;
 
-  auto it = properties.find(name);
-  if (it == properties.end()) {
-    ret = lclass->getMethod(name);
-    if (ret.has_value())
-      // then must be a method
-      return ret.value()->bind(interp, this);
-    return std::nullopt;
-  }
-  // field
-  return it->second;
+  if ((index = shape->find(name)).has_value())
+    return field(index.value());
+  ret = lclass->getMethod(name);
+  if (ret.has_value())
+    // then must be a method
+    return ret.value()->bind(interp, this);
+  return std::nullopt;
 }
 
-void Linstance::set(std::string name, Ltype obj) {
-  // create if doesn't exist or assign other
-  properties[name] = obj;
+void Linstance::set(Interp& interp, Symbol name, Ltype obj) {
+  std::optional<std::size_t> index;
+
+  interp.writeBarrier(this, obj);
+  if ((index = shape->find(name)).has_value())
+    field(index.value()) = obj;
+  else
+    add(interp, shape->with(name), obj);
+}
+
+void Linstance::add(Interp& interp, const Shape* next, Ltype obj) {
+  std::size_t capacity;
+
+  shape = next;
+  if (shape->size() <= N_INLINE) {
+    fields[shape->size() - 1] = obj;
+    return;
+  }
+  capacity = moreFields.capacity();
+  moreFields.push_back(obj);
+  interp.grow(this, (moreFields.capacity() - capacity) * sizeof(Ltype));
 }
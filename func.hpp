@@ -1,14 +1,17 @@
 #pragma once
+#include <cstdint>
 #include <list>
 #include <optional>
 #include <unordered_map>
 #include <variant>
+#include <vector>
 
 #include "functional.hpp"
 #include "interp.hpp"
 #include "ltype.hpp"
-#include "runent.hpp"
+#include "shape.hpp"
 #include "stmt_fwd.hpp"
+#include "symbol.hpp"
 #include "uncopyable.hpp"
 
 class Func : public Uncopyable {
@@ -34,69 +37,103 @@ class Clock : public Func {
   Ltype call(Interp& interp, const std::list<Ltype>& args) final;
 };
 
-class Lfunc : public Func, public RunEnt {
+// writes a heap snapshot to the configured path, returns whether one is
+// configured
+class HeapSnapshot : public Func {
+ private:
+  HeapSnapshot();
+
+ public:
+  static HeapSnapshot* get();
+
+  Ltype call(Interp& interp, const std::list<Ltype>& args) final;
+};
+
+class Lfunc : public Func {
  private:
   friend class Interp;
 
   const std::shared_ptr<const Functional> funp;
-  Interp::Env* enclosing;
+  // in the order of funp->upvalues
+  const std::vector<Interp::Cell*> upvalues;
+  // 'this' of a bound method
+  Linstance* receiver;
   bool isCtor;
 
+  // in a frame with the parameters defined
+  Ltype body(Interp& interp, Linstance* receiver);
+
  public:
   Lfunc(std::shared_ptr<const Functional> funp,
-        Interp::Env* enclosing,
+        std::vector<Interp::Cell*> upvalues,
+        Linstance* receiver,
         bool isCtor);
   Lfunc() = delete;
 
   Ltype call(Interp& interp, const std::list<Ltype>& args) final;
+  // args points to arity values, read before the body runs
+  Ltype call(Interp& interp, const Ltype* args);
+  // a method called on receiver, as if bound to it
+  Ltype call(Interp& interp,
+             Linstance* receiver,
+             const std::list<Ltype>& args);
+  Ltype call(Interp& interp, Linstance* receiver, const Ltype* args);
 
   Lfunc* bind(Interp& interp, Linstance* inst) const;
 };
 
-class Lclass : public Func, public RunEnt {
+class Lclass : public Func {
  private:
   friend class Interp;
-  const std::string name;
+  const Symbol name;
+  // unique, unlike addresses, which freed classes leave to others
+  const std::uint64_t id;
 
-  const std::unordered_map<std::string, Lfunc*> methods;
-  const std::unordered_map<std::string, Lfunc*> staticMethods;
+  // inherited ones included, so lookups do not walk up to base
+  const std::unordered_map<Symbol, Lfunc*> methods;
+  const std::unordered_map<Symbol, Lfunc*> staticMethods;
   Lclass* base;
-  Interp::Env* superEnv;
-
-  std::optional<Lfunc*> get(
-      const std::unordered_map<std::string, Lfunc*>& table,
-      std::optional<Lfunc*> (Lclass::*getter)(std::string) const,
-      std::string name) const;
 
  public:
-  Lclass(std::string name,
+  Lclass(Symbol name,
          std::size_t ctorArity,
-         std::unordered_map<std::string, Lfunc*> methods,
-         std::unordered_map<std::string, Lfunc*> staticMethods,
-         Lclass* base,
-         Interp::Env* superEnv);
+         std::unordered_map<Symbol, Lfunc*> methods,
+         std::unordered_map<Symbol, Lfunc*> staticMethods,
+         Lclass* base);
 
   Lclass() = delete;
 
-  std::optional<Lfunc*> getMethod(std::string name) const;
+  std::optional<Lfunc*> getMethod(Symbol name) const;
 
-  std::optional<Lfunc*> getStaticMethod(std::string name) const;
+  std::optional<Lfunc*> getStaticMethod(Symbol name) const;
 
   Ltype call(Interp& interp, const std::list<Ltype>& args) final;
 };
 
-class Linstance : public Uncopyable, public RunEnt {
+class Linstance : public Uncopyable {
  private:
   friend class Interp;
 
+  // in the object itself, the rest go to moreFields
+  static constexpr std::size_t N_INLINE = 4;
+
   Lclass* lclass;
-  std::unordered_map<std::string, Ltype> properties;
+  const Shape* shape;
+  // indexed by shape
+  Ltype fields[N_INLINE];
+  std::vector<Ltype> moreFields;
+
+  Ltype& field(std::size_t index) {
+    return index < N_INLINE ? fields[index] : moreFields[index - N_INLINE];
+  }
+  // sets the field added by next, the shape that follows the current one
+  void add(Interp& interp, const Shape* next, Ltype obj);
 
  public:
   Linstance(Lclass* lclass);
   Linstance() = delete;
 
-  std::optional<Ltype> get(Interp& interp, std::string name);
+  std::optional<Ltype> get(Interp& interp, Symbol name);
 
-  void set(std::string name, Ltype obj);
+  void set(Interp& interp, Symbol name, Ltype obj);
 };
@@ -1,12 +1,19 @@
 #include <list>
 #include <memory>
 
+#include "chunk.hpp"
 #include "stmt.hpp"
 
 #include "functional.hpp"
 
 Functional::Functional(std::list<Token> params,
                        std::unique_ptr<const StmtList>&& listp)
-    : params(params), listp(std::move(listp)) {}
+    : params(params),
+      listp(std::move(listp)),
+      nSlots(0),
+      paramLocals{},
+      thisLocal(std::nullopt),
+      upvalues{},
+      chunk(nullptr) {}
 
 Functional::~Functional() = default;
@@ -1,14 +1,32 @@
 #pragma once
+#include <cstddef>
 #include <list>
 #include <memory>
+#include <optional>
+#include <vector>
 
+#include "local.hpp"
 #include "stmt_fwd.hpp"
 #include "token.hpp"
 
+struct Chunk;
+
 struct Functional {
   const std::list<Token> params;
   const std::unique_ptr<const StmtList> listp;
 
+  // filled in by Resolver
+  // size of the frame of a call
+  mutable std::size_t nSlots;
+  // in order of params
+  mutable std::vector<std::optional<Local>> paramLocals;
+  // instance methods only
+  mutable std::optional<Local> thisLocal;
+  // captured when a closure is created
+  mutable std::vector<Upvalue> upvalues;
+  // filled in by Compiler, for the bytecode backend only
+  mutable std::unique_ptr<const Chunk> chunk;
+
   Functional() = delete;
   Functional(std::list<Token> params, std::unique_ptr<const StmtList>&& listp);
   ~Functional();
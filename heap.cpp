@@ -0,0 +1,68 @@
+#include <cassert>
+#include <cstddef>
+#include <memory>
+
+#include "heap.hpp"
+
+Heap::Heap()
+    : pools(MAX_SIZE / ALIGN + 2), young{}, epoch(1), unswept(0) {
+  for (std::size_t i = 0; i < pools.size(); i++) {
+    pools[i].slotUnits = i;
+    pools[i].slabSlots = i == 0 ? 0 : SLAB_SIZE / (i * ALIGN);
+    pools[i].freeList = nullptr;
+    pools[i].sweepSlab = 0;
+    pools[i].sweepEnd = 0;
+  }
+}
+
+Heap::Pool& Heap::poolOf(std::size_t size) {
+  assert(size <= MAX_SIZE);
+  // the header takes a unit of its own
+  return pools[1 + (size + ALIGN - 1) / ALIGN];
+}
+
+void Heap::grow(Pool& pool) {
+  pool.slabs.push_back(
+      std::make_unique<Unit[]>(pool.slabSlots * pool.slotUnits));
+  // slots are handed out in address order
+  Unit* slab = pool.slabs.back().get();
+  for (std::size_t i = pool.slabSlots; i-- > 0;) {
+    Unit* slot = slab + i * pool.slotUnits;
+    reinterpret_cast<Header*>(slot)->kind = Kind::FREE;
+    next(slot) = pool.freeList;
+    pool.freeList = slot;
+  }
+}
+
+void Heap::free(void* obj) {
+  assert(!young.empty() && young.back() == obj);
+  young.pop_back();
+  recycle(static_cast<Unit*>(obj) - 1);
+}
+
+void Heap::startSweep() {
+  assert(young.empty());
+  // slabs added meanwhile only hold objects allocated after marking
+  for (Pool& pool : pools) {
+    pool.sweepSlab = 0;
+    pool.sweepEnd = pool.slabs.size();
+    unswept += pool.sweepEnd;
+  }
+}
+
+const char* Heap::name(Kind kind) {
+  switch (kind) {
+    case Kind::CELL:
+      return "Cell";
+    case Kind::LFUNC:
+      return "Lfunc";
+    case Kind::LCLASS:
+      return "Lclass";
+    case Kind::LINSTANCE:
+      return "Linstance";
+    case Kind::LSTRING:
+      return "Lstring";
+    default:
+      return "free";
+  }
+}
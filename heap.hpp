@@ -0,0 +1,204 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "uncopyable.hpp"
+
+// storage of the objects the collector manages. Objects are segregated
+// by size into pools of fixed size slots carved from slabs. Each slot
+// starts with a header, followed by the object itself, so the heap can be
+// swept by scanning the slabs without knowing the static type of objects.
+// Objects never move: they are young until they survive a collection,
+// then promoted to old in place.
+// An object is marked if its mark is the current epoch. Flipping the
+// epoch unmarks every object at once, and young objects start out with a
+// mark no epoch has. After a full collection the old objects are swept
+// lazily, a slab at a time, when a pool runs out of free slots
+class Heap : public Uncopyable {
+ public:
+  enum class Kind : unsigned char {
+    FREE,
+    CELL,
+    LFUNC,
+    LCLASS,
+    LINSTANCE,
+    LSTRING
+  };
+
+  struct Header {
+    Kind kind;
+    // of the slot, in units
+    unsigned char units;
+    unsigned char mark;
+    bool isOld;
+    // old, and in the remembered set of the collector
+    bool isRemembered;
+    // charged by the collector, what the object owns included
+    std::size_t size;
+  };
+
+  // of the type of objects of kind
+  static const char* name(Kind kind);
+
+  // objects start this far into their slot, and may need no stricter
+  // alignment
+  static constexpr std::size_t ALIGN = alignof(std::max_align_t);
+  static_assert(sizeof(Header) <= ALIGN);
+  // objects larger than this are not supported
+  static constexpr std::size_t MAX_SIZE = 512;
+
+ private:
+  struct alignas(ALIGN) Unit {
+    std::byte bytes[ALIGN];
+  };
+
+  // slots of one size class
+  struct Pool {
+    // in units, header included
+    std::size_t slotUnits;
+    std::vector<std::unique_ptr<Unit[]>> slabs;
+    std::size_t slabSlots;
+    // free slots link through their object storage
+    Unit* freeList;
+    // slabs from this one up to sweepEnd are not swept yet
+    std::size_t sweepSlab;
+    std::size_t sweepEnd;
+  };
+
+  static constexpr std::size_t SLAB_SIZE = 1 << 14;
+  // of young objects
+  static constexpr unsigned char UNMARKED = 0;
+
+  std::vector<Pool> pools;
+  // allocated since the last collection, in allocation order
+  std::vector<void*> young;
+  // 1 or 2
+  unsigned char epoch;
+  // slabs not swept yet, of every pool
+  std::size_t unswept;
+
+  static Unit*& next(Unit* slot) {
+    return *reinterpret_cast<Unit**>(slot + 1);
+  }
+  Pool& poolOf(std::size_t size);
+  void grow(Pool& pool);
+  // back onto the free list of its pool
+  void recycle(Unit* slot) {
+    Header& h = *reinterpret_cast<Header*>(slot);
+    h.kind = Kind::FREE;
+    next(slot) = pools[h.units].freeList;
+    pools[h.units].freeList = slot;
+  }
+
+  // frees the unmarked old objects of the next slab of pool. Young ones
+  // were allocated after marking, or swept already
+  template <typename F>
+  void sweepSlab(Pool& pool, F& release) {
+    Unit* slab = pool.slabs[pool.sweepSlab++].get();
+    Unit* end = slab + pool.slabSlots * pool.slotUnits;
+
+    unswept--;
+    for (Unit* slot = slab; slot != end; slot += pool.slotUnits) {
+      Header& h = *reinterpret_cast<Header*>(slot);
+      if (h.kind == Kind::FREE || !h.isOld || h.mark == epoch)
+        continue;
+      release(h.kind, static_cast<void*>(slot + 1));
+      recycle(slot);
+    }
+  }
+
+ public:
+  Heap();
+
+  static Header& header(const void* obj) {
+    return *reinterpret_cast<Header*>(
+        const_cast<Unit*>(static_cast<const Unit*>(obj) - 1));
+  }
+
+  bool isMarked(const void* obj) const { return header(obj).mark == epoch; }
+  void setMarked(const void* obj) { header(obj).mark = epoch; }
+  // marks obj, returns whether it was not marked yet. Threads may mark at
+  // once, as long as none reads marks otherwise
+  bool tryMark(const void* obj) {
+    return std::atomic_ref<unsigned char>(header(obj).mark)
+               .exchange(epoch, std::memory_order_relaxed) != epoch;
+  }
+  // starts a full collection, sweeping must be done
+  void flip() { epoch = static_cast<unsigned char>(3 - epoch); }
+
+  // storage for an object of size bytes, tagged with kind. The caller
+  // constructs the object in it. If the pool has no free slot, its slabs
+  // still to sweep are swept first, calling release(kind, obj) for every
+  // object to destroy
+  template <typename F>
+  void* allocate(std::size_t size, Kind kind, F release) {
+    Pool& pool = poolOf(size);
+    Unit* slot;
+
+    while (pool.freeList == nullptr && pool.sweepSlab < pool.sweepEnd)
+      sweepSlab(pool, release);
+    if (pool.freeList == nullptr)
+      grow(pool);
+    slot = pool.freeList;
+    pool.freeList = next(slot);
+    *reinterpret_cast<Header*>(slot) = Header{
+        kind, static_cast<unsigned char>(pool.slotUnits), UNMARKED, 0, 0,
+        size};
+    young.push_back(slot + 1);
+    return slot + 1;
+  }
+  // returns the storage of the last allocation, whose object could not be
+  // constructed
+  void free(void* obj);
+
+  // after marking. Young objects must be swept first
+  void startSweep();
+  bool isSweeping() const { return unswept != 0; }
+  // sweeps at most n more slabs, returns whether sweeping is done
+  template <typename F>
+  bool sweepSome(F release, std::size_t n) {
+    for (Pool& pool : pools) {
+      for (; n > 0 && pool.sweepSlab < pool.sweepEnd; n--)
+        sweepSlab(pool, release);
+    }
+    return !isSweeping();
+  }
+
+  // frees the unmarked young objects, the others become old
+  template <typename F>
+  void sweepYoung(F release) {
+    for (void* obj : young) {
+      Header& h = header(obj);
+      if (h.mark == epoch) {
+        h.isOld = 1;
+        continue;
+      }
+      release(h.kind, obj);
+      recycle(static_cast<Unit*>(obj) - 1);
+    }
+    young.clear();
+  }
+
+  // frees every object
+  template <typename F>
+  void clear(F release) {
+    for (Pool& pool : pools) {
+      for (auto& slab : pool.slabs) {
+        Unit* end = slab.get() + pool.slabSlots * pool.slotUnits;
+        for (Unit* slot = slab.get(); slot != end; slot += pool.slotUnits) {
+          Header& h = *reinterpret_cast<Header*>(slot);
+          if (h.kind == Kind::FREE)
+            continue;
+          release(h.kind, static_cast<void*>(slot + 1));
+          recycle(slot);
+        }
+      }
+      pool.sweepSlab = pool.sweepEnd = 0;
+    }
+    young.clear();
+    unswept = 0;
+  }
+};
@@ -0,0 +1,103 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <ostream>
+
+#include "heap_stats.hpp"
+
+HeapStats::Pause::Pause(HeapStats& stats) : stats(stats), start{} {
+  if (stats.isEnabled)
+    start = std::chrono::steady_clock::now();
+}
+
+HeapStats::Pause::~Pause() {
+  if (stats.isEnabled) {
+    stats.pause(std::chrono::duration<double, std::micro>(
+                    std::chrono::steady_clock::now() - start)
+                    .count());
+  }
+}
+
+HeapStats::HeapStats(bool isEnabled)
+    : isEnabled(isEnabled),
+      youngCollections(0),
+      fullCollections(0),
+      bytesAllocated(0),
+      bytesFreed(0),
+      peakSize(0),
+      allocated{},
+      freed{},
+      live{},
+      marking{},
+      pauses{},
+      nPauses(0),
+      pauseTotal(0),
+      pauseMax(0) {}
+
+void HeapStats::pause(double us) {
+  std::size_t bucket = 0;
+
+  if (us > MIN_PAUSE)
+    bucket = std::min(
+        static_cast<std::size_t>(std::log2(us / MIN_PAUSE) *
+                                 static_cast<double>(BUCKETS_PER_DOUBLING)),
+        N_BUCKETS - 1);
+  pauses[bucket]++;
+  nPauses++;
+  pauseTotal += us;
+  pauseMax = std::max(pauseMax, us);
+}
+
+void HeapStats::endMark() {
+  live = marking;
+  marking.fill(0);
+}
+
+void HeapStats::write(std::ostream& os, std::size_t heapSize) const {
+  // nearest rank, the upper bound of the bucket holding it
+  auto percentile = [this](double p) {
+    std::size_t rank, seen;
+
+    rank = static_cast<std::size_t>(
+        std::ceil(p / 100 * static_cast<double>(nPauses)));
+    rank = std::max(rank, std::size_t(1));
+    seen = 0;
+    for (std::size_t i = 0; i < N_BUCKETS; i++) {
+      if ((seen += pauses[i]) >= rank)
+        return std::min(
+            MIN_PAUSE * std::exp2(static_cast<double>(i + 1) /
+                                  static_cast<double>(BUCKETS_PER_DOUBLING)),
+            pauseMax);
+    }
+    return 0.0;
+  };
+  // FREE excluded
+  auto byKind = [&os](auto count) {
+    for (std::size_t i = 1; i < N_KINDS; i++) {
+      os << (i == 1 ? "" : ", ") << '"'
+         << Heap::name(static_cast<Heap::Kind>(i)) << "\": " << count(i);
+    }
+  };
+
+  os << "{\n";
+  os << "  \"collections\": {\"young\": " << youngCollections
+     << ", \"full\": " << fullCollections << "},\n";
+  os << "  \"pauses_us\": {\"count\": " << nPauses
+     << ", \"total\": " << pauseTotal << ", \"p50\": " << percentile(50)
+     << ", \"p90\": " << percentile(90) << ", \"p99\": " << percentile(99)
+     << ", \"max\": " << pauseMax << "},\n";
+  os << "  \"bytes_allocated\": " << bytesAllocated << ",\n";
+  os << "  \"bytes_freed\": " << bytesFreed << ",\n";
+  os << "  \"heap_size\": " << heapSize << ",\n";
+  os << "  \"peak_heap_size\": " << peakSize << ",\n";
+  // reachable at the end of the last full collection
+  os << "  \"live_objects\": {";
+  byKind([this](std::size_t i) { return live[i]; });
+  os << "},\n";
+  // on the heap at exit, garbage not collected yet included
+  os << "  \"heap_objects\": {";
+  byKind([this](std::size_t i) { return allocated[i] - freed[i]; });
+  os << "}\n";
+  os << "}\n";
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <ostream>
+
+#include "heap.hpp"
+#include "uncopyable.hpp"
+
+// of the collector, for the report written as JSON at exit. Counters are
+// always kept, pauses are only timed if enabled
+class HeapStats : public Uncopyable {
+ public:
+  static constexpr std::size_t N_KINDS =
+      static_cast<std::size_t>(Heap::Kind::LSTRING) + 1;
+
+  // times a pause of the program for collecting, until destroyed
+  class Pause : public Uncopyable {
+   private:
+    HeapStats& stats;
+    std::chrono::steady_clock::time_point start;
+
+   public:
+    Pause(HeapStats& stats);
+    ~Pause();
+  };
+
+  const bool isEnabled;
+  std::size_t youngCollections;
+  std::size_t fullCollections;
+  std::size_t bytesAllocated;
+  std::size_t bytesFreed;
+  std::size_t peakSize;
+  // objects allocated and freed, by kind
+  std::array<std::size_t, N_KINDS> allocated;
+  std::array<std::size_t, N_KINDS> freed;
+  // objects marked by the last full collection, and by the current one
+  std::array<std::size_t, N_KINDS> live;
+  std::array<std::size_t, N_KINDS> marking;
+  // pauses in microseconds, counted in buckets of exponentially growing
+  // width, so the memory taken does not grow with the run. Percentiles
+  // are accurate to the width of a bucket, about 9%
+  static constexpr std::size_t N_BUCKETS = 256;
+  static constexpr std::size_t BUCKETS_PER_DOUBLING = 8;
+  // the bound of the first bucket, the last one takes what is above it
+  static constexpr double MIN_PAUSE = 0.01;
+  std::array<std::size_t, N_BUCKETS> pauses;
+  std::size_t nPauses;
+  double pauseTotal;
+  double pauseMax;
+
+  HeapStats(bool isEnabled);
+
+  // heapSize includes the new object
+  void allocate(Heap::Kind kind, std::size_t size, std::size_t heapSize) {
+    allocated[static_cast<std::size_t>(kind)]++;
+    bytesAllocated += size;
+    peakSize = std::max(peakSize, heapSize);
+  }
+  // by an object owning more memory
+  void grow(std::size_t bytes, std::size_t heapSize) {
+    bytesAllocated += bytes;
+    peakSize = std::max(peakSize, heapSize);
+  }
+  void free(Heap::Kind kind, std::size_t size) {
+    freed[static_cast<std::size_t>(kind)]++;
+    bytesFreed += size;
+  }
+  void mark(Heap::Kind kind) { marking[static_cast<std::size_t>(kind)]++; }
+  void pause(double us);
+  // of a full collection
+  void endMark();
+
+  void write(std::ostream& os, std::size_t heapSize) const;
+};
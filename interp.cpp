@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <iostream>
 #include <list>
 #include <string>
@@ -8,11 +9,16 @@
 // #include <chrono>
 // for readAll -- reading from a file
 #include <cassert>
+#include <chrono>
+#include <cstdint>
 #include <fstream>
 #include <optional>
+#include <utility>
 #include <variant>
 
 #include "assert.hpp"
+#include "chunk.hpp"
+#include "compiler.hpp"
 #include "expr.hpp"
 #include "func.hpp"
 #include "io.hpp"
@@ -21,6 +27,7 @@
 #include "scanner.hpp"
 #include "stmt.hpp"
 #include "token.hpp"
+#include "vm.hpp"
 
 #include "interp.hpp"
 
@@ -36,76 +43,75 @@ bool Interp::floatEquality(double a, double b) const {
   return diff <= std::max(std::abs(a), std::abs(b)) * relEps;
 }
 
-template <typename T>
-constexpr bool always_false_v = false;
+bool Interp::stringEquality(StrPtr left, StrPtr right) const {
+  if (left == right)
+    return 1;
+  if ((left->isInterned && right->isInterned) || left->size() != right->size())
+    return 0;
+  return left->hashCode() == right->hashCode() &&
+         left->view() == right->view();
+}
 
 bool Interp::equality(const Ltype& left, const Ltype& right) const {
-  bool ret;
-
-  std::visit(
-      [this, &ret](auto x, auto y) -> void {
-        using T = decltype(x);
-        using U = decltype(y);
-
-        if constexpr (!std::is_same_v<T, U>) {
-          ret = 0;
-        } else {
-          if constexpr (std::is_same_v<T, Lstring> || std::is_same_v<T, bool>)
-            ret = x == y;
-          else if constexpr (std::is_same_v<T, double>)
-            ret = floatEquality(x, y);
-          else if constexpr (std::is_same_v<T, Lnil>)
-            ret = 1;
-          else if constexpr (std::is_same_v<T, FunPtr> ||
-                             std::is_same_v<T, LfunPtr> ||
-                             std::is_same_v<T, InstPtr> ||
-                             std::is_same_v<T, ClassPtr>)
-            ret = !std::less<T>()(x, y) && !std::less<T>()(y, x);
-          else
-            static_assert(always_false_v<T>);
-        }
-      },
-      left, right);
+  if (left.type() != right.type())
+    return 0;
 
-  return ret;
+  switch (left.type()) {
+    case Ltype::Type::STRING:
+      return stringEquality(left.get<StrPtr>(), right.get<StrPtr>());
+    case Ltype::Type::NUMBER:
+      return floatEquality(left.get<double>(), right.get<double>());
+    case Ltype::Type::BOOL:
+      return left.get<bool>() == right.get<bool>();
+    case Ltype::Type::NIL:
+      return 1;
+    case Ltype::Type::FUN:
+      return left.get<FunPtr>() == right.get<FunPtr>();
+    case Ltype::Type::LFUN:
+      return left.get<LfunPtr>() == right.get<LfunPtr>();
+    case Ltype::Type::INST:
+      return left.get<InstPtr>() == right.get<InstPtr>();
+    case Ltype::Type::CLASS:
+      return left.get<ClassPtr>() == right.get<ClassPtr>();
+  }
+
+  return 0;
 }
 
 Ltype Interp::visit(const ExprBinary* expr) {
   Ltype ret, left, right;
-  ReclaimerCtx ctx(*this);
+  RootScope scope(*this);
 
-  left = ctx.add(eval(expr->left));
-  right = ctx.add(eval(expr->right));
+  left = scope.add(eval(expr->left));
+  right = scope.add(eval(expr->right));
 
   switch (expr->oper.type) {
     case MINUS:
       checkNumberOperands(expr->oper, left, right);
-      ret = std::get<double>(left) - std::get<double>(right);
+      ret = left.get<double>() - right.get<double>();
       break;
     case STAR:
       checkNumberOperands(expr->oper, left, right);
-      ret = std::get<double>(left) * std::get<double>(right);
+      ret = left.get<double>() * right.get<double>();
       break;
     case SLASH:
       checkNumberOperands(expr->oper, left, right);
-      if (floatEquality(std::get<double>(right), 0.0))
+      if (floatEquality(right.get<double>(), 0.0))
         throw RuntimeError(expr->oper, "division by zero");
-      ret = std::get<double>(left) / std::get<double>(right);
+      ret = left.get<double>() / right.get<double>();
       break;
     case PERCENT:
       checkNumberOperands(expr->oper, left, right);
-      if (floatEquality(std::get<double>(right), 0.0))
+      if (floatEquality(right.get<double>(), 0.0))
         throw RuntimeError(expr->oper, "division by zero");
 
-      ret = std::fmod(std::get<double>(left), std::get<double>(right));
+      ret = std::fmod(left.get<double>(), right.get<double>());
       break;
     case PLUS:
-      if (std::holds_alternative<double>(left) &&
-          std::holds_alternative<double>(right))
-        ret = std::get<double>(left) + std::get<double>(right);
-      else if (std::holds_alternative<Lstring>(left) &&
-               std::holds_alternative<Lstring>(right))
-        ret = std::get<Lstring>(left) + std::get<Lstring>(right);
+      if (left.is<double>() && right.is<double>())
+        ret = left.get<double>() + right.get<double>();
+      else if (left.is<StrPtr>() && right.is<StrPtr>())
+        ret = concat(scope, left.get<StrPtr>(), right.get<StrPtr>());
       else
         throw RuntimeError(expr->oper,
                            "operands must be numbers or strings, got: " +
@@ -119,19 +125,19 @@ Ltype Interp::visit(const ExprBinary* expr) {
       break;
     case LESS:
       checkNumberOperands(expr->oper, left, right);
-      ret = std::get<double>(left) < std::get<double>(right);
+      ret = left.get<double>() < right.get<double>();
       break;
     case LESS_EQUAL:
       checkNumberOperands(expr->oper, left, right);
-      ret = std::get<double>(left) <= std::get<double>(right);
+      ret = left.get<double>() <= right.get<double>();
       break;
     case GREATER:
       checkNumberOperands(expr->oper, left, right);
-      ret = std::get<double>(left) > std::get<double>(right);
+      ret = left.get<double>() > right.get<double>();
       break;
     case GREATER_EQUAL:
       checkNumberOperands(expr->oper, left, right);
-      ret = std::get<double>(left) >= std::get<double>(right);
+      ret = left.get<double>() >= right.get<double>();
       break;
     default:
       myAssert(expr->oper, "unhandled binary operator");
@@ -148,9 +154,9 @@ Ltype Interp::visit(const ExprComma* expr) {
 
 Ltype Interp::visit(const ExprLogical* expr) {
   Ltype ret, left, right;
-  ReclaimerCtx ctx(*this);
+  RootScope scope(*this);
 
-  left = ctx.add(eval(expr->left));
+  left = scope.add(eval(expr->left));
 
   switch (expr->oper.type) {
     case OR:
@@ -189,7 +195,7 @@ Ltype Interp::visit(const ExprUnary* expr) {
   switch (expr->oper.type) {
     case MINUS:
       checkNumberOperands(expr->oper, right);
-      ret = -std::get<double>(right);
+      ret = -right.get<double>();
       break;
     case BANG:
       ret = !isTruthful(right);
@@ -203,120 +209,245 @@ Ltype Interp::visit(const ExprUnary* expr) {
 }
 
 Ltype Interp::visit(const ExprTern* expr) {
-  ReclaimerCtx ctx(*this);
+  RootScope scope(*this);
   Ltype res;
 
-  res = ctx.add(eval(expr->cond));
+  res = scope.add(eval(expr->cond));
   if (isTruthful(res))
     return eval(expr->thenp);
   return eval(expr->elsep);
 }
 
 Ltype Interp::visit(const ExprVar* expr) {
-  return lookupVariable(expr->token, expr);
+  return lookupVariable(expr->token, expr->local);
 }
 
 Ltype Interp::visit(const ExprAssign* expr) {
   Ltype value;
 
-  auto distance = locals.find(expr);
   value = eval(expr->exprp);
-  if (distance != locals.end())
-    envp->assignAt(expr->token, value, distance->second);
-  else
-    global.assign(expr->token, value);
+  if (expr->local.has_value()) {
+    setVariable(expr->local.value(), value);
+  } else {
+    auto it = globals.find(expr->token.symbol);
+    if (it == globals.end())
+      throw RuntimeError(expr->token, "undeclared variable");
+    it->second = value;
+  }
   return value;
 }
 
+FunPtr Interp::checkCallable(const Token& paren,
+                             Ltype callee,
+                             std::size_t argc) {
+  FunPtr ptr;
+
+  if (!callee.isCallable())
+    throw RuntimeError(paren, "call to " + typeToString(callee) +
+                                  ": can only call functions and constructors");
+  ptr = callee.getCallable();
+  checkArity(paren, ptr, argc);
+  return ptr;
+}
+
+void Interp::checkArity(const Token& paren, FunPtr ptr, std::size_t argc) {
+  if (ptr->arity != argc)
+    throw RuntimeError(paren, "expected " + std::to_string(ptr->arity) +
+                                  " arguments, got " + std::to_string(argc));
+}
+
 Ltype Interp::visit(const ExprCall* expr) {
   Ltype callee;
   FunPtr ptr;
   std::list<Ltype> evaluatedArgs;
-  ReclaimerCtx ctx(*this);
-
-  ctx.add(callee = eval(expr->exprp));
-
-  std::visit(
-      [&ptr, &expr, &callee](auto x) -> void {
-        using T = decltype(x);
-
-        if constexpr (std::is_convertible_v<T, FunPtr>) {
-          ptr = x;
-        } else {
-          throw RuntimeError(expr->savedParen,
-                             "call to " + typeToString(callee) +
-                                 ": can only call functions and constructors");
-        }
-      },
-      callee);
-  if (ptr->arity != expr->args.size())
-    throw RuntimeError(expr->savedParen, "expected " +
-                                             std::to_string(ptr->arity) +
-                                             " arguments, got " +
-                                             std::to_string(expr->args.size()));
+  const PropertyCache::Entry* entry;
+  std::optional<Ltype> property;
+  Lfunc* method;
+  RootScope scope(*this);
+
+  ptr = nullptr;
+  method = nullptr;
+  if (const ExprGet* get = expr->method) {
+    scope.add(callee = eval(get->exprp));
+    if (callee.is<InstPtr>() &&
+        (entry = lookupProperty(get->token.symbol, callee.get<InstPtr>(),
+                                get->cache)) != nullptr &&
+        entry->kind == PropertyCache::Kind::METHOD)
+      // called on callee, never bound
+      method = entry->method;
+    else if ((property = getProperty(get->token.symbol, callee, get->cache))
+                 .has_value())
+      callee = property.value();
+    else
+      callee = getProperty(get->token, callee);
+  } else {
+    callee = eval(expr->exprp);
+  }
+  if (method != nullptr) {
+    checkArity(expr->savedParen, method, expr->args.size());
+  } else {
+    scope.add(callee);
+    ptr = checkCallable(expr->savedParen, callee, expr->args.size());
+  }
 
   for (const std::shared_ptr<const Expr>& exprp : expr->args)
-    evaluatedArgs.push_back(ctx.add(eval(exprp)));
+    evaluatedArgs.push_back(scope.add(eval(exprp)));
+  if (method != nullptr)
+    return method->call(*this, callee.get<InstPtr>(), evaluatedArgs);
   return ptr->call(*this, evaluatedArgs);
 }
 
-Ltype Interp::visit(const ExprGet* expr) {
-  Ltype obj;
+Ltype Interp::getProperty(const Token& token, Ltype obj) {
   std::optional<Ltype> ret;
-  ReclaimerCtx ctx(*this);
-
-  obj = ctx.add(eval(expr->exprp));
 
-  if (std::holds_alternative<InstPtr>(obj))
-    ret = std::get<InstPtr>(obj)->get(*this, expr->token.lexeme);
-  else if (std::holds_alternative<ClassPtr>(obj))
+  if (obj.is<InstPtr>())
+    ret = obj.get<InstPtr>()->get(*this, token.symbol);
+  else if (obj.is<ClassPtr>())
     // treat as an access to a static method
-    ret = std::get<ClassPtr>(obj)->getStaticMethod(expr->token.lexeme);
+    ret = obj.get<ClassPtr>()->getStaticMethod(token.symbol);
   else
-    throw RuntimeError(expr->token, "property access on a non-class object");
+    throw RuntimeError(token, "property access on a non-class object");
   if (!ret.has_value())
-    throw RuntimeError(expr->token, "undefined property");
+    throw RuntimeError(token, "undefined property");
   return ret.value();
 }
 
+const PropertyCache::Entry* Interp::lookupProperty(Symbol name,
+                                                   InstPtr inst,
+                                                   PropertyCache& cache) {
+  using Kind = PropertyCache::Kind;
+  const PropertyCache::Entry* entry;
+  std::optional<std::size_t> index;
+  std::optional<Lfunc*> method;
+
+  if ((entry = cache.findGet(inst->shape, inst->lclass->id)) != nullptr)
+    return entry;
+  if ((index = inst->shape->find(name)).has_value())
+    return &cache.add(
+        {Kind::FIELD, inst->shape, 0, index.value(), nullptr, nullptr});
+  if ((method = inst->lclass->getMethod(name)).has_value())
+    return &cache.add({Kind::METHOD, inst->shape, inst->lclass->id, 0,
+                       nullptr, method.value()});
+  return nullptr;
+}
+
+std::optional<Ltype> Interp::getProperty(Symbol name,
+                                         Ltype obj,
+                                         PropertyCache& cache) {
+  using Kind = PropertyCache::Kind;
+  const PropertyCache::Entry* entry;
+  std::optional<Lfunc*> method;
+
+  if (obj.is<InstPtr>()) {
+    InstPtr inst = obj.get<InstPtr>();
+
+    if ((entry = lookupProperty(name, inst, cache)) == nullptr)
+      return std::nullopt;
+    if (entry->kind == Kind::FIELD)
+      return inst->field(entry->index);
+    return entry->method->bind(*this, inst);
+  }
+  if (obj.is<ClassPtr>()) {
+    ClassPtr lclass = obj.get<ClassPtr>();
+
+    if ((entry = cache.findStatic(lclass->id)) == nullptr) {
+      if (!(method = lclass->getStaticMethod(name)).has_value())
+        return std::nullopt;
+      entry = &cache.add(
+          {Kind::STATIC, nullptr, lclass->id, 0, nullptr, method.value()});
+    }
+    return entry->method;
+  }
+  return std::nullopt;
+}
+
+void Interp::setProperty(InstPtr inst,
+                         Symbol name,
+                         Ltype value,
+                         PropertyCache& cache) {
+  using Kind = PropertyCache::Kind;
+  const PropertyCache::Entry* entry;
+  std::optional<std::size_t> index;
+  const Shape* next;
+
+  if ((entry = cache.findSet(inst->shape)) == nullptr) {
+    if ((index = inst->shape->find(name)).has_value()) {
+      entry = &cache.add(
+          {Kind::FIELD, inst->shape, 0, index.value(), nullptr, nullptr});
+    } else {
+      next = inst->shape->with(name);
+      entry = &cache.add(
+          {Kind::ADD, inst->shape, 0, next->size() - 1, next, nullptr});
+    }
+  }
+  writeBarrier(inst, value);
+  if (entry->kind == Kind::FIELD)
+    inst->field(entry->index) = value;
+  else
+    inst->add(*this, entry->next, value);
+}
+
+Ltype Interp::visit(const ExprGet* expr) {
+  RootScope scope(*this);
+
+  Ltype obj;
+  std::optional<Ltype> ret;
+
+  scope.add(obj = eval(expr->exprp));
+  if ((ret = getProperty(expr->token.symbol, obj, expr->cache)).has_value())
+    return ret.value();
+  // reports the error
+  return getProperty(expr->token, obj);
+}
+
 Ltype Interp::visit(const ExprSet* expr) {
   Ltype obj;
   Ltype rvalue;
-  ReclaimerCtx ctx(*this);
+  RootScope scope(*this);
 
-  obj = ctx.add(eval(expr->get->exprp));
+  obj = scope.add(eval(expr->get->exprp));
 
-  if (!std::holds_alternative<InstPtr>(obj))
+  if (!obj.is<InstPtr>())
     throw RuntimeError(expr->token, "only class instances have fields");
-  rvalue = ctx.add(eval(expr->exprp));
-  std::get<InstPtr>(obj)->set(expr->token.lexeme, rvalue);
+  rvalue = scope.add(eval(expr->exprp));
+  setProperty(obj.get<InstPtr>(), expr->token.symbol, rvalue, expr->cache);
   return rvalue;
 }
 
 Ltype Interp::visit(const ExprThis* expr) {
-  return lookupVariable(expr->token, expr);
+  return lookupVariable(expr->token, expr->local);
+}
+
+Ltype Interp::getSuper(const Token& method,
+                       ClassPtr superPtr,
+                       InstPtr receiver) {
+  std::optional<Lfunc*> ret;
+
+  // static methods have no 'this' to bind to
+  if (receiver != nullptr &&
+      (ret = superPtr->getMethod(method.symbol)).has_value())
+    return ret.value()->bind(*this, receiver);
+  ret = superPtr->getStaticMethod(method.symbol);
+  if (ret.has_value())
+    return ret.value();
+  throw RuntimeError(method, "undefined property");
 }
 
 Ltype Interp::visit(const ExprSuper* expr) {
   ClassPtr superPtr;
-  std::optional<Lfunc*> method;
-  std::size_t distance;
-
-  distance = locals[expr];
-  superPtr = std::get<ClassPtr>(envp->getAt(expr->token, distance));
-  if ((method = superPtr->getMethod(expr->method.lexeme)).has_value())
-    return method.value()->bind(
-        *this, std::get<InstPtr>(envp->getAt(
-                   Token(Token::Type::THIS, "this", "", 0), distance - 1)));
-  method = superPtr->getStaticMethod(expr->method.lexeme);
-  if (method.has_value())
-    return method.value();
-  throw RuntimeError(expr->method, "undefined property");
+  InstPtr receiver;
+
+  // always resolved, 'super' can not be global
+  superPtr = lookupVariable(expr->token, expr->local).get<ClassPtr>();
+  receiver = nullptr;
+  if (expr->thisLocal.has_value())
+    receiver = lookupVariable(expr->token, expr->thisLocal).get<InstPtr>();
+  return getSuper(expr->method, superPtr, receiver);
 }
 
 Ltype Interp::visit(std::shared_ptr<const ExprFun> expr) {
-  ReclaimerCtx ctx(*this);
-  return alloc<Lfunc>(ctx, expr, envp, false);
+  RootScope scope(*this);
+  return closure(scope, expr, false);
 }
 
 Ltype Interp::eval(std::shared_ptr<const Expr> expr) {
@@ -324,14 +455,13 @@ Ltype Interp::eval(std::shared_ptr<const Expr> expr) {
 }
 
 bool Interp::isTruthful(const Ltype& obj) const {
-  if ((std::holds_alternative<bool>(obj) && std::get<bool>(obj) == 0) ||
-      std::holds_alternative<Lnil>(obj))
+  if ((obj.is<bool>() && obj.get<bool>() == 0) || obj.is<Lnil>())
     return 0;
   return 1;
 }
 
 void Interp::checkNumberOperands(Token oper, const Ltype& obj) const {
-  if (!std::holds_alternative<double>(obj))
+  if (!obj.is<double>())
     throw RuntimeError(oper,
                        "operand must be a number, got: " + typeToString(obj));
 }
@@ -339,14 +469,16 @@ void Interp::checkNumberOperands(Token oper, const Ltype& obj) const {
 void Interp::checkNumberOperands(Token oper,
                                  const Ltype& left,
                                  const Ltype& right) const {
-  if (!std::holds_alternative<double>(left) ||
-      !std::holds_alternative<double>(right))
+  if (!left.is<double>() || !right.is<double>())
     throw RuntimeError(
         oper, "operands must be numbers, got: " + typeToString(left) + ", " +
                   typeToString(right));
 }
 
-void Interp::interpret(const std::list<std::shared_ptr<const Stmt>>& list) {
+void Interp::interpret(const std::list<std::shared_ptr<const Stmt>>& list,
+                       std::size_t nSlots) {
+  Frame frame(*this, nullptr, nSlots);
+
   try {
     for (const std::shared_ptr<const Stmt>& s : list)
       execute(*s.get());
@@ -360,99 +492,137 @@ void Interp::execute(const Stmt& stmt) {
   stmt.accept(*this);
 }
 
-void Interp::execute(const StmtList& stmt, Env* setEnv) {
-  Env* save;
-
-  save = envp;
-  envp = setEnv;
+void Interp::visit(const StmtList& stmt) {
   for (const std::shared_ptr<const Stmt>& p : stmt.stmts) {
-    try {
-      execute(*p.get());
-      // control flow or any other, such as division by zero.
-    } catch (std::exception& ex) {
-      envp = save;
-      throw;
-    }
+    execute(*p.get());
+    if (completion != Completion::NORMAL)
+      return;
   }
-  envp = save;
 }
 
-void Interp::visit(const StmtList& stmt) {
-  ReclaimerCtx ctx(*this);
-  execute(stmt, alloc<Env>(ctx, envp));
+Ltype Interp::returnValue() {
+  Ltype ret;
+
+  // implicitly return nil by default, in case of no return statement
+  ret = Lnil();
+  if (completion == Completion::RETURN)
+    ret = retVal;
+  completion = Completion::NORMAL;
+  return ret;
 }
 
-Interp::Env::Env() : enclosing(nullptr), m{} {}
+Interp::Cell::Cell(std::optional<Ltype> value) : value(value) {}
 
-Interp::Env::Env(Env* enclosing) : enclosing(enclosing), m{} {}
+Interp::Frame::Frame(Interp& interp, Lfunc* closure, std::size_t nSlots)
+    : interp(interp),
+      caller(interp.framep),
+      closure(closure),
+      base(interp.slots.size()),
+      nSlots(nSlots) {
+  interp.slots.resize(base + nSlots, Slot{std::nullopt, nullptr});
+  interp.framep = this;
+}
 
-void Interp::Env::def(const Token& token, std::optional<Ltype> obj) {
-  // allow redeclaring in global -- for REPL
-  if (enclosing != nullptr) {
-    // case 1:	case 2:
-    // var x;	var x;	== nullopt
-    // var x = 5;	var x;	== nullopt again
-    auto ret = m.find(token.lexeme);
-    if (ret != m.end() && (ret->second != std::nullopt || !obj.has_value()))
-      throw RuntimeError(token, "redeclaration");
-  }
-  m[token.lexeme] = obj;
-}
-
-Ltype Interp::Env::get(const Token& token) const {
-  auto ret = m.find(token.lexeme);
-  if (ret == m.end()) {
-    if (enclosing != nullptr)
-      return enclosing->get(token);
-    else
-      throw RuntimeError(token, "undeclared variable");
-  } else if (!ret->second.has_value()) {
-    throw RuntimeError(token, "uninitialized variable");
-  }
+// also when unwinding from control flow or a runtime error
+Interp::Frame::~Frame() {
+  interp.slots.resize(base);
+  interp.framep = caller;
+}
 
-  return ret->second.value();
+// references are invalidated by the next call
+Interp::Slot& Interp::slot(std::size_t index) {
+  assert(index < framep->nSlots);
+  return slots[framep->base + index];
 }
 
-Ltype Interp::Env::assertGet(const Token& token) const {
-  auto ret = m.find(token.lexeme);
-  assert(ret != m.end());
-  if (!ret->second.has_value()) {
-    throw RuntimeError(token, "uninitialized variable");
-  }
+std::optional<Ltype>& Interp::cell(std::size_t index) {
+  Cell* ptr;
 
-  return ret->second.value();
+  ptr = slot(index).cell;
+  assert(ptr != nullptr);
+  return ptr->value;
 }
 
-Ltype Interp::Env::getAt(const Token& token, std::size_t distance) {
-  return ancestor(distance)->assertGet(token);
+std::optional<Ltype>& Interp::upvalue(std::size_t index) {
+  return framep->closure->upvalues[index]->value;
 }
 
-Interp::Env* Interp::Env::ancestor(std::size_t distance) {
-  Env* env;
-  std::size_t i;
+std::optional<Ltype>& Interp::variable(const Local& local) {
+  if (local.isUpvalue)
+    return upvalue(local.index);
+  if (local.isBoxed)
+    return cell(local.index);
+  return slot(local.index).value;
+}
+
+void Interp::setCell(std::size_t index, Ltype value) {
+  Cell* ptr;
 
-  for (i = 0, env = this; i < distance; i++)
-    env = env->enclosing;
-  return env;
+  ptr = slot(index).cell;
+  assert(ptr != nullptr);
+  writeBarrier(ptr, value);
+  ptr->value = value;
 }
 
-void Interp::Env::assign(const Token& token, Ltype obj) {
-  auto ret = m.find(token.lexeme);
-  if (ret == m.end()) {
-    if (enclosing != nullptr) {
-      enclosing->assign(token, obj);
-      return;
-    } else {
-      throw RuntimeError(token, "undeclared variable");
-    }
+void Interp::setUpvalue(std::size_t index, Ltype value) {
+  Cell* ptr;
+
+  ptr = framep->closure->upvalues[index];
+  writeBarrier(ptr, value);
+  ptr->value = value;
+}
+
+void Interp::setVariable(const Local& local, Ltype value) {
+  if (local.isUpvalue)
+    setUpvalue(local.index, value);
+  else if (local.isBoxed)
+    setCell(local.index, value);
+  else
+    slot(local.index).value = value;
+}
+
+void Interp::define(const std::optional<Local>& local,
+                    const Token& token,
+                    std::optional<Ltype> obj) {
+  // allow redeclaring in global -- for REPL
+  // redeclaring a local is caught by Resolver
+  if (!local.has_value()) {
+    globals[token.symbol] = obj;
+    return;
+  }
+  assert(!local->isUpvalue);
+  // a fresh cell each time, closures created by earlier executions keep
+  // theirs
+  if (local->isBoxed) {
+    Cell* cell = doAlloc<Cell>(obj);
+    slot(local->index).cell = cell;
+  } else {
+    slot(local->index).value = obj;
   }
-  ret->second = obj;
 }
 
-void Interp::Env::assignAt(const Token& token,
-                           Ltype obj,
-                           std::size_t distance) {
-  ancestor(distance)->assign(token, obj);
+void Interp::initialize(const std::optional<Local>& local,
+                        const Token& token,
+                        Ltype obj) {
+  if (local.has_value())
+    setVariable(local.value(), obj);
+  else
+    globals[token.symbol] = obj;
+}
+
+Lfunc* Interp::closure(RootScope& scope,
+                       std::shared_ptr<const Functional> funp,
+                       bool isCtor) {
+  std::vector<Cell*> upvalues;
+
+  upvalues.reserve(funp->upvalues.size());
+  for (const Upvalue& upvalue : funp->upvalues) {
+    if (upvalue.isLocal)
+      upvalues.push_back(slot(upvalue.index).cell);
+    else
+      upvalues.push_back(framep->closure->upvalues[upvalue.index]);
+  }
+  return alloc<Lfunc>(scope, funp, std::move(upvalues), nullptr, isCtor);
 }
 
 void Interp::visit(const StmtExpr& stmt) {
@@ -464,29 +634,25 @@ void Interp::visit(const StmtPrint& stmt) {
 }
 
 void Interp::visit(const StmtLoop& stmt) {
-  ReclaimerCtx ctx(*this);
-
-  if (stmt.exprp == nullptr) {
-    while (isTruthful(ctx.add(eval(stmt.condp)))) {
-      try {
-        execute(*stmt.body);
-      } catch (Break& exception) {
+  // the condition and increment are dropped before anything is allocated,
+  // so no roots are kept across iterations
+  while (isTruthful(eval(stmt.condp))) {
+    execute(*stmt.body);
+    switch (completion) {
+      case Completion::BREAK:
+        completion = Completion::NORMAL;
+        return;
+      case Completion::RETURN:
+        // for the enclosing call
+        return;
+      case Completion::CONTINUE:
+        completion = Completion::NORMAL;
         break;
-      } catch (Continue& exception) {
-        ;
-      }
-    }
-  } else {
-    while (isTruthful(ctx.add(eval(stmt.condp)))) {
-      try {
-        execute(*stmt.body);
-      } catch (Break& exception) {
+      case Completion::NORMAL:
         break;
-      } catch (Continue& exception) {
-        ;
-      }
-      ctx.add(eval(stmt.exprp));
     }
+    if (stmt.exprp != nullptr)
+      eval(stmt.exprp);
   }
 }
 
@@ -495,15 +661,15 @@ void Interp::visit(const StmtVar& stmt) {
   // the possible initializing expression. This makes weird code in global
   // scope like the following erroneous
   // var x = x;
-  envp->def(stmt.token, std::nullopt);
+  define(stmt.local, stmt.token, std::nullopt);
   if (stmt.exprp != nullptr)
-    envp->def(stmt.token, eval(stmt.exprp));
+    initialize(stmt.local, stmt.token, eval(stmt.exprp));
 }
 
 void Interp::visit(const StmtIf& stmt) {
-  ReclaimerCtx ctx(*this);
+  RootScope scope(*this);
 
-  if (isTruthful(ctx.add(eval(stmt.condp))))
+  if (isTruthful(scope.add(eval(stmt.condp))))
     execute(*stmt.thenBranch);
   else if (stmt.elseBranch != nullptr)
     execute(*stmt.elseBranch);
@@ -512,10 +678,10 @@ void Interp::visit(const StmtIf& stmt) {
 void Interp::visit(const StmtLoopFlow& stmt) {
   switch (stmt.token.type) {
     case BREAK:
-      throw Interp::Break();
+      completion = Completion::BREAK;
       break;
     case CONTINUE:
-      throw Interp::Continue();
+      completion = Completion::CONTINUE;
       break;
     default:
       myAssert(stmt.token, "unhandled loop flow control statement");
@@ -524,67 +690,80 @@ void Interp::visit(const StmtLoopFlow& stmt) {
 }
 
 void Interp::visit(std::shared_ptr<const StmtFun> stmtp) {
-  ReclaimerCtx ctx(*this);
+  RootScope scope(*this);
+  // declared first, so a local function can capture itself
+  define(stmtp->local, stmtp->token, std::nullopt);
   // false -- not a ctor
-  envp->def(stmtp->token, alloc<Lfunc>(ctx, stmtp, envp, false));
+  initialize(stmtp->local, stmtp->token, closure(scope, stmtp, false));
 }
 
 void Interp::visit(const StmtReturn& stmt) {
-  Ltype retVal;
-
   // implicitly return nil by default
   retVal = Lnil();
   if (stmt.exprp != nullptr)
     retVal = eval(stmt.exprp);
-
-  throw Interp::Return(retVal);
+  completion = Completion::RETURN;
 }
 
 void Interp::visit(const StmtClass& stmt) {
+  std::optional<Ltype> superObj;
+  RootScope scope(*this);
+
+  // a local class is visible to its methods, a global one is looked up
+  // by name when they run
+  if (stmt.local.has_value())
+    define(stmt.local, stmt.token, std::nullopt);
+  if (stmt.superExpr != nullptr)
+    superObj = scope.add(eval(stmt.superExpr));
+  defineClass(stmt, superObj);
+}
+
+// superObj is rooted by the caller
+void Interp::defineClass(const StmtClass& stmt,
+                         std::optional<Ltype> superObj) {
+  static const Token super(Token::Type::SUPER, "super", "", 0,
+                           Symbols::intern("super"));
   Ltype obj;
   ClassPtr superPtr;
-  std::unordered_map<std::string, Lfunc*> methods, staticMethods;
+  std::unordered_map<Symbol, Lfunc*> methods, staticMethods;
   std::size_t ctorArity;
   ClassPtr cptr;
-  Env *save, *enclose;
 
-  ReclaimerCtx ctx(*this);
+  RootScope scope(*this);
 
   ctorArity = 0;
   superPtr = nullptr;
-  enclose = nullptr;
 
-  if (stmt.superExpr != nullptr) {
-    obj = ctx.add(eval(stmt.superExpr));
-    if (!std::holds_alternative<ClassPtr>(obj))
+  if (superObj.has_value()) {
+    obj = superObj.value();
+    if (!obj.is<ClassPtr>())
       throw RuntimeError(stmt.superExpr->token,
                          "expected class, got " + typeToString(obj));
 
-    superPtr = std::get<ClassPtr>(obj);
-    enclose = alloc<Env>(ctx, envp);
-    enclose->def(Token(Token::Type::SUPER, "super", "", 0), superPtr);
-    save = envp;
-    envp = enclose;
+    superPtr = obj.get<ClassPtr>();
+    define(stmt.superLocal, super, superPtr);
+    // copied down, then overridden by the methods of the class
+    methods = superPtr->methods;
+    staticMethods = superPtr->staticMethods;
+    // a ctor is never inherited, even by a class named like its base
+    methods.erase(stmt.token.symbol);
   }
 
   for (const std::shared_ptr<const StmtFun>& ptr : stmt.methods)
-    methods[ptr->token.lexeme] = alloc<Lfunc>(ctx, ptr, envp, false);
+    methods[ptr->token.symbol] = closure(scope, ptr, false);
   for (const std::shared_ptr<const StmtFun>& ptr : stmt.staticMethods)
-    staticMethods[ptr->token.lexeme] = alloc<Lfunc>(ctx, ptr, envp, false);
+    staticMethods[ptr->token.symbol] = closure(scope, ptr, false);
   // look for optional ctor definition
   if (stmt.ctor != nullptr) {
     ctorArity = stmt.ctor->params.size();
     // true -- is a ctor
-    methods[stmt.token.lexeme] = alloc<Lfunc>(ctx, stmt.ctor, envp, true);
+    methods[stmt.token.symbol] = closure(scope, stmt.ctor, true);
   }
 
-  cptr = alloc<Lclass>(ctx, stmt.token.lexeme, ctorArity, methods,
-                       staticMethods, superPtr, enclose);
-  // does not restore if previous code throws an exception, but the only
-  // possible is OOM, which is unrecoverable
-  if (stmt.superExpr != nullptr)
-    envp = save;
-  envp->def(stmt.token, cptr);
+  cptr = alloc<Lclass>(scope, stmt.token.symbol, ctorArity,
+                       std::move(methods), std::move(staticMethods),
+                       superPtr);
+  initialize(stmt.local, stmt.token, cptr);
 }
 
 void Interp::handleRuntimeError(RuntimeError& ex) {
@@ -594,11 +773,24 @@ void Interp::handleRuntimeError(RuntimeError& ex) {
 Interp::RuntimeError::RuntimeError(Token token, std::string what)
     : std::runtime_error(what), token(token) {}
 
+void Interp::interpret(const Chunk& chunk, std::size_t nSlots) {
+  Frame frame(*this, nullptr, nSlots);
+
+  try {
+    Vm(*this).run(chunk);
+    // lets through std::runtime_error, which is OOM and is unrecoverable
+  } catch (RuntimeError& e) {
+    operands.clear();
+    handleRuntimeError(e);
+  }
+}
+
 void Interp::run(std::string inputStr) {
   std::list<Token> tokenList;
   std::list<std::shared_ptr<const Stmt>> stmtPList;
+  std::unique_ptr<const Chunk> chunk;
 
-  Resolver resolver(*this);
+  Resolver resolver;
 
   Scanner scanner(inputStr);
 
@@ -611,7 +803,14 @@ void Interp::run(std::string inputStr) {
   resolver.resolve(stmtPList);
   if (hadError)
     return;
-  interpret(stmtPList);
+  if (config.backend == Backend::AST) {
+    interpret(stmtPList, resolver.nSlots());
+    return;
+  }
+  chunk = Compiler().compileScript(stmtPList);
+  if (hadError)
+    return;
+  interpret(*chunk, resolver.nSlots());
 }
 
 void Interp::testScanner(std::string inputStr) {
@@ -676,91 +875,591 @@ void Interp::report(std::size_t lineNum,
             << '\n';
 }
 
-Interp::Interp() : envp(&global), heapSize(0) {
-  envp->def(Token(Token::Type::EOFF, "clock", "clock", 0),
-            Clock::get());
+Interp::Config::Config()
+    : backend(Backend::AST),
+      heapMin(std::size_t(1) << 20),
+      heapGrowth(2),
+      heapMax(std::size_t(1) << 30),
+      heapNursery(std::size_t(1) << 18),
+      heapStep(0),
+      heapThreads(1),
+      heapStats{},
+      heapSnapshot{} {}
+
+Interp::Interp() : Interp(Config()) {}
+
+Interp::Interp(Config config)
+    : config(config),
+      globals{},
+      framep(nullptr),
+      slots{},
+      heapSize(0),
+      threshold(std::min(config.heapMin, config.heapMax)),
+      youngSize(0),
+      isMinor(0),
+      liveSize(0),
+      unsweptSize(0),
+      phase(Phase::IDLE),
+      stats(!config.heapStats.empty()),
+      gray{},
+      pool(config.heapThreads > 1
+               ? std::make_unique<ThreadPool>(config.heapThreads)
+               : nullptr),
+      markers(config.heapThreads > 1 ? config.heapThreads : 0),
+      nActive(0),
+      nShares(0),
+      isSnapshotKept(0),
+      completion(Completion::NORMAL),
+      retVal(Lnil()) {
+  roots.reserve(1024);
+  globals[Symbols::intern("clock")] = Clock::get();
+  globals[Symbols::intern("heapSnapshot")] = HeapSnapshot::get();
 }
 
 Interp::~Interp() {
-  reclaim();
+  if (stats.isEnabled)
+    writeStats();
+  if (!config.heapSnapshot.empty() && !isSnapshotKept)
+    writeSnapshot();
+  finish();
+  heap.clear(releaser());
+}
+
+StrPtr Interp::intern(RootScope& scope, std::string str) {
+  StrPtr ret;
+
+  if ((ret = Lstring::find(str)) != nullptr) {
+    if (ret->isConstant || heap.isMarked(ret))
+      return ret;
+    // revived, it may be white while marking, or garbage not swept yet
+    if (phase == Phase::MARK) {
+      mark(ret);
+    } else if (heap.isSweeping() && Heap::header(ret).isOld) {
+      heap.setMarked(ret);
+      unsweptSize -= Heap::header(ret).size;
+    }
+    return ret;
+  }
+  ret = alloc<Lstring>(scope, std::move(str));
+  Lstring::insert(ret);
+  return ret;
+}
+
+StrPtr Interp::concat(RootScope& scope, StrPtr left, StrPtr right) {
+  // short results are cheap to copy and worth keeping interned
+  const std::size_t INTERN_MAX = 64;
+
+  if (left->size() == 0)
+    return right;
+  if (right->size() == 0)
+    return left;
+  if (left->size() + right->size() <= INTERN_MAX)
+    return intern(scope,
+                  std::string(left->view()) + std::string(right->view()));
+  return alloc<Lstring>(scope, left, right);
+}
+
+Ltype Interp::lookupVariable(const Token& token,
+                             const std::optional<Local>& local) {
+  std::optional<Ltype>* obj;
+
+  if (local.has_value()) {
+    obj = &variable(local.value());
+  } else {
+    auto it = globals.find(token.symbol);
+    if (it == globals.end())
+      throw RuntimeError(token, "undeclared variable");
+    obj = &it->second;
+  }
+  if (!obj->has_value())
+    throw RuntimeError(token, "uninitialized variable");
+  return obj->value();
+}
+
+void Interp::writeBarrier(void* obj, const Ltype& value) {
+  Heap::Header& header = Heap::header(obj);
+  void* target;
+
+  if ((target = heapObject(value)) == nullptr)
+    return;
+  // black objects never reference white ones
+  if (phase == Phase::MARK && heap.isMarked(obj))
+    mark(target);
+  if (header.isOld && !header.isRemembered && !Heap::header(target).isOld) {
+    header.isRemembered = 1;
+    remembered.push_back(obj);
+  }
+}
+
+void Interp::grow(void* obj, std::size_t bytes) {
+  Heap::Header& header = Heap::header(obj);
+
+  header.size += bytes;
+  heapSize += bytes;
+  if (!header.isOld)
+    youngSize += bytes;
+  // counted when it was marked
+  if (heap.isMarked(obj))
+    liveSize += bytes;
+  stats.grow(bytes, heapSize);
+}
+
+void Interp::collect() {
+  HeapStats::Pause pause(stats);
+
+  stats.fullCollections++;
+  // marks from the last one must not be flipped before sweeping
+  heap.sweepSome(sweeper(), SIZE_MAX);
+  assert(unsweptSize == 0);
+  heap.flip();
+  liveSize = 0;
+  for (void* obj : remembered)
+    Heap::header(obj).isRemembered = 0;
+  remembered.clear();
+  markRoots();
+  // the first step is taken by the next allocation
+  if (config.heapStep != 0) {
+    phase = Phase::MARK;
+    return;
+  }
+  traceGray();
+  endMark();
+}
+
+void Interp::step() {
+  HeapStats::Pause pause(stats);
+  // between reading the clock
+  const std::size_t TRACE_WORK = 64;
+  const std::size_t SWEEP_WORK = 1;
+  auto deadline = std::chrono::steady_clock::now() +
+                  std::chrono::microseconds(config.heapStep);
+
+  do {
+    if (phase == Phase::MARK) {
+      if (traceGray(TRACE_WORK))
+        endMark();
+    } else {
+      heap.sweepSome(sweeper(), SWEEP_WORK);
+    }
+  } while ((phase == Phase::MARK || heap.isSweeping()) &&
+           std::chrono::steady_clock::now() < deadline);
 }
 
-void Interp::resolve(const Expr* expr, std::size_t distance) {
-  locals[expr] = distance;
+void Interp::finish() {
+  HeapStats::Pause pause(stats);
+
+  if (phase == Phase::MARK)
+    endMark();
+  heap.sweepSome(sweeper(), SIZE_MAX);
 }
 
-Ltype Interp::lookupVariable(const Token& token, const Expr* expr) {
-  auto distance = locals.find(expr);
-  if (distance != locals.end())
-    return envp->getAt(token, distance->second);
-  return global.get(token);
+void Interp::endMark() {
+  const double MIN_GROWTH = 1.25;
+  double target;
+
+  // roots are written without a barrier
+  if (phase == Phase::MARK) {
+    markRoots();
+    traceGray();
+    phase = Phase::IDLE;
+  }
+  stats.endMark();
+  // may be garbage
+  for (void* obj : remembered)
+    Heap::header(obj).isRemembered = 0;
+  remembered.clear();
+  heap.sweepYoung(releaser());
+  youngSize = 0;
+  unsweptSize = heapSize - liveSize;
+  heap.startSweep();
+
+  // amortizes collections over allocations proportional to the live size,
+  // with some headroom even for a factor of 1. In double, as the product
+  // may be past any size
+  target = static_cast<double>(liveSize) *
+           std::max(config.heapGrowth, MIN_GROWTH);
+  target = std::max(target, static_cast<double>(config.heapMin));
+  if (target >= static_cast<double>(config.heapMax))
+    threshold = config.heapMax;
+  else
+    threshold = static_cast<std::size_t>(target);
 }
 
-void Interp::mark(Env* env) {
-  env->isReachable = 1;
-  for (auto& [_, optObj] : env->m) {
+void Interp::collectYoung() {
+  HeapStats::Pause pause(stats);
+
+  stats.youngCollections++;
+  isMinor = 1;
+  markRoots();
+  for (void* obj : remembered) {
+    Heap::header(obj).isRemembered = 0;
+    trace(obj);
+  }
+  remembered.clear();
+  traceGray();
+  isMinor = 0;
+  heap.sweepYoung(releaser());
+  youngSize = 0;
+}
+
+std::string Interp::Edge::str() const {
+  if (name != Symbols::NONE)
+    return std::string(kind) + ' ' + Symbols::name(name);
+  if (index != NO_INDEX)
+    return std::string(kind) + ' ' + std::to_string(index);
+  return std::string(kind);
+}
+
+template <typename F>
+void Interp::forEachRoot(F f) {
+  auto ltype = [&f](const Ltype& l, const Edge& edge) {
+    if (void* obj = heapObject(l))
+      f(obj, edge);
+  };
+  std::size_t i;
+
+  for (i = 0; i < roots.size(); i++)
+    ltype(roots[i], {"temporary", {}, i});
+  for (i = 0; i < operands.size(); i++)
+    ltype(operands[i], {"operand", {}, i});
+  for (auto& [name, optObj] : globals) {
     if (optObj.has_value())
-      markLtype(optObj.value());
+      ltype(optObj.value(), {"global", name, NO_INDEX});
+  }
+  for (i = 0; i < slots.size(); i++) {
+    if (slots[i].value.has_value())
+      ltype(slots[i].value.value(), {"slot", {}, i});
+    // may be left over from an ended scope, kept alive until the slot
+    // is reused
+    if (slots[i].cell != nullptr)
+      f(slots[i].cell, Edge{"cell", {}, i});
+  }
+  // from the innermost
+  i = 0;
+  for (Frame* frame = framep; frame != nullptr; frame = frame->caller, i++) {
+    if (frame->closure != nullptr)
+      f(frame->closure, Edge{"closure", {}, i});
+  }
+}
+
+template <typename F>
+void Interp::forEachRef(void* obj, F f) {
+  auto ltype = [&f](const Ltype& l, const Edge& edge) {
+    if (void* ref = heapObject(l))
+      f(ref, edge);
+  };
+
+  switch (Heap::header(obj).kind) {
+    case Heap::Kind::CELL: {
+      Cell* cell = static_cast<Cell*>(obj);
+      if (cell->value.has_value())
+        ltype(cell->value.value(), {"value", {}, NO_INDEX});
+      break;
+    }
+    case Heap::Kind::LFUNC: {
+      Lfunc* func = static_cast<Lfunc*>(obj);
+      for (std::size_t i = 0; i < func->upvalues.size(); i++)
+        f(func->upvalues[i], Edge{"upvalue", {}, i});
+      if (func->receiver != nullptr)
+        f(func->receiver, Edge{"receiver", {}, NO_INDEX});
+      break;
+    }
+    case Heap::Kind::LCLASS: {
+      Lclass* lclass = static_cast<Lclass*>(obj);
+      for (auto& [name, method] : lclass->methods)
+        f(method, Edge{"method", name, NO_INDEX});
+      for (auto& [name, staticMethod] : lclass->staticMethods)
+        f(staticMethod, Edge{"static method", name, NO_INDEX});
+      if (lclass->base != nullptr)
+        f(lclass->base, Edge{"base", {}, NO_INDEX});
+      break;
+    }
+    case Heap::Kind::LINSTANCE: {
+      Linstance* inst = static_cast<Linstance*>(obj);
+      inst->shape->forEach([&](Symbol name, std::size_t index) {
+        ltype(inst->field(index), {"property", name, NO_INDEX});
+      });
+      f(inst->lclass, Edge{"class", {}, NO_INDEX});
+      break;
+    }
+    case Heap::Kind::LSTRING:
+      break;
+    default:
+      assert(0);
+  }
+}
+
+void Interp::markRoots() {
+  forEachRoot([this](void* obj, const Edge&) { mark(obj); });
+}
+
+void Interp::mark(void* obj) {
+  Heap::Header& header = Heap::header(obj);
+
+  if (heap.isMarked(obj) || (isMinor && header.isOld))
+    return;
+  heap.setMarked(obj);
+  if (!isMinor) {
+    liveSize += header.size;
+    stats.mark(header.kind);
+  }
+  // strings reference nothing
+  if (header.kind != Heap::Kind::LSTRING)
+    gray.push_back(obj);
+}
+
+void* Interp::heapObject(const Ltype& l) {
+  switch (l.type()) {
+    case Ltype::Type::STRING:
+      // constants live outside the heap
+      if (l.get<StrPtr>()->isConstant)
+        return nullptr;
+      return l.get<StrPtr>();
+    case Ltype::Type::LFUN:
+      return l.get<LfunPtr>();
+    case Ltype::Type::INST:
+      return l.get<InstPtr>();
+    case Ltype::Type::CLASS:
+      return l.get<ClassPtr>();
+    default:
+      return nullptr;
+  }
+}
+
+void Interp::mark(void* obj, Marker& marker) {
+  Heap::Header& header = Heap::header(obj);
+
+  if (!heap.tryMark(obj))
+    return;
+  marker.liveSize += header.size;
+  marker.marked[static_cast<std::size_t>(header.kind)]++;
+  if (header.kind != Heap::Kind::LSTRING)
+    marker.gray.push_back(obj);
+}
+
+void Interp::traceGray() {
+  // young collections are too small to be worth waking threads
+  if (pool == nullptr || isMinor) {
+    traceGray(SIZE_MAX);
+    return;
+  }
+
+  // dealt out, the markers even out the work by stealing
+  for (std::size_t i = 0; i < gray.size(); i++)
+    markers[i % markers.size()].gray.push_back(gray[i]);
+  gray.clear();
+  nActive = markers.size();
+  pool->run([this](std::size_t index) { traceParallel(index); });
+  for (Marker& marker : markers) {
+    liveSize += marker.liveSize;
+    for (std::size_t i = 0; i < HeapStats::N_KINDS; i++)
+      stats.marking[i] += marker.marked[i];
+    marker.liveSize = 0;
+    marker.marked.fill(0);
+  }
+}
+
+bool Interp::traceGray(std::size_t n) {
+  void* obj;
+
+  for (; n > 0 && !gray.empty(); n--) {
+    obj = gray.back();
+    gray.pop_back();
+    trace(obj);
+  }
+  return gray.empty();
+}
+
+void Interp::traceParallel(std::size_t index) {
+  // kept private before sharing the rest
+  const std::size_t PRIVATE = 64;
+  Marker& marker = markers[index];
+  auto markRef = [this, &marker](void* ref, const Edge&) {
+    mark(ref, marker);
+  };
+  void* obj;
+
+  do {
+    while (!marker.gray.empty()) {
+      obj = marker.gray.back();
+      marker.gray.pop_back();
+      forEachRef(obj, markRef);
+      if (marker.gray.size() > 2 * PRIVATE && marker.nShared == 0) {
+        std::lock_guard<std::mutex> guard(marker.lock);
+        // the oldest, which tend to lead to the most
+        marker.shared.assign(marker.gray.begin(),
+                             marker.gray.end() - PRIVATE);
+        marker.gray.erase(marker.gray.begin(), marker.gray.end() - PRIVATE);
+        marker.nShared = marker.shared.size();
+        nShares++;
+        nShares.notify_all();
+      }
+    }
+  } while (steal(index));
+}
+
+bool Interp::steal(std::size_t index) {
+  auto hasShared = [this] {
+    for (Marker& marker : markers) {
+      if (marker.nShared != 0)
+        return 1;
+    }
+    return 0;
+  };
+  Marker& thief = markers[index];
+
+  while (1) {
+    // its own shared objects first, so none are left once it is idle
+    for (std::size_t i = 0; i < markers.size(); i++) {
+      Marker& victim = markers[(index + i) % markers.size()];
+      if (victim.nShared == 0)
+        continue;
+      std::lock_guard<std::mutex> guard(victim.lock);
+      // half, rounded up
+      std::size_t n = (victim.shared.size() + 1) / 2;
+      auto from = victim.shared.end() - static_cast<std::ptrdiff_t>(n);
+      thief.gray.insert(thief.gray.end(), from, victim.shared.end());
+      victim.shared.erase(from, victim.shared.end());
+      victim.nShared = victim.shared.size();
+      if (n != 0)
+        return 1;
+    }
+    // idle markers share nothing, so when all are idle nothing is shared
+    if (--nActive == 0) {
+      nShares++;
+      nShares.notify_all();
+      return 0;
+    }
+    while (1) {
+      std::size_t seen = nShares;
+      if (hasShared())
+        break;
+      if (nActive == 0)
+        return 0;
+      nShares.wait(seen);
+    }
+    nActive++;
   }
-  if (env->enclosing != nullptr)
-    mark(env->enclosing);
 }
 
-void Interp::mark(Lfunc* func) {
-  func->isReachable = 1;
-  mark(func->enclosing);
+void Interp::trace(void* obj) {
+  forEachRef(obj, [this](void* ref, const Edge&) { mark(ref); });
 }
 
-void Interp::mark(Lclass* lclass) {
-  lclass->isReachable = 1;
-  for (auto& [_, method] : lclass->methods)
-    mark(method);
-  for (auto& [_, staticMethod] : lclass->staticMethods)
-    mark(staticMethod);
-  if (lclass->base != nullptr) {
-    mark(lclass->base);
-    mark(lclass->superEnv);
+void Interp::writeSnapshot() {
+  // of reachable objects, in breadth first order from the roots, so the
+  // retainer of each is on a shortest path to it. Ids start at 1, 0 is
+  // the roots
+  std::vector<void*> objects;
+  std::vector<std::pair<std::size_t, std::string>> retainers;
+  std::unordered_map<void*, std::size_t> ids;
+  auto discover = [&](std::size_t retainer) {
+    return [&, retainer](void* obj, const Edge& edge) {
+      if (ids.emplace(obj, objects.size() + 1).second) {
+        objects.push_back(obj);
+        retainers.emplace_back(retainer, edge.str());
+      }
+    };
+  };
+  std::ofstream os(config.heapSnapshot);
+
+  forEachRoot(discover(0));
+  for (std::size_t i = 0; i < objects.size(); i++)
+    forEachRef(objects[i], discover(i + 1));
+
+  os << "[\n";
+  for (std::size_t i = 0; i < objects.size(); i++) {
+    const Heap::Header& header = Heap::header(objects[i]);
+    const char* sep = "";
+
+    os << "{\"id\": " << i + 1 << ", \"type\": \"" << Heap::name(header.kind)
+       << "\", \"size\": " << header.size
+       << ", \"retainer\": " << retainers[i].first << ", \"edge\": \""
+       << retainers[i].second << "\", \"refs\": [";
+    forEachRef(objects[i], [&](void* ref, const Edge& edge) {
+      os << sep << '[' << ids[ref] << ", \"" << edge.str() << "\"]";
+      sep = ", ";
+    });
+    os << "]}" << (i + 1 < objects.size() ? "," : "") << '\n';
   }
+  os << "]\n";
+  if (!os)
+    std::cerr << "error writing " << config.heapSnapshot << '\n';
+}
+
+std::size_t Interp::sizeOf(const Cell&) {
+  return sizeof(Cell);
+}
+
+std::size_t Interp::sizeOf(const Lfunc& func) {
+  return sizeof(Lfunc) + func.upvalues.capacity() * sizeof(Cell*);
 }
 
-void Interp::mark(Linstance* obj) {
-  obj->isReachable = 1;
-  for (auto& [_, lobj] : obj->properties)
-    markLtype(lobj);
-  mark(obj->lclass);
+std::size_t Interp::sizeOf(const Lclass& lclass) {
+  return sizeof(Lclass) + tableSize(lclass.methods) +
+         tableSize(lclass.staticMethods);
 }
 
-void Interp::markLtype(Ltype& l) {
-  std::visit(
-      [this](auto x) -> void {
-        using T = decltype(x);
-        if constexpr (std::is_convertible_v<T, RunEnt*>) {
-          if (!x->isReachable)
-            mark(x);
-        }
-      },
-      l);
+std::size_t Interp::sizeOf(const Linstance& obj) {
+  // shapes are shared, and never freed
+  return sizeof(Linstance) + obj.moreFields.capacity() * sizeof(Ltype);
 }
 
-void Interp::reclaim() {
-  auto it = traced.begin();
-  auto prev = it;
-  while (it != traced.end()) {
-    prev = it++;
-    std::visit(
-        [this, prev](auto y) -> void {
-          if (y->isReachable)
-            return;
-          delete y;
-          heapSize -= sizeof(std::remove_pointer_t<decltype(y)>);
-          traced.erase(prev);
-        },
-        *prev);
+std::size_t Interp::sizeOf(const Lstring& str) {
+  // buffers may be shared by several strings, each is charged what it
+  // allocated, so a buffer built by appending is charged once overall
+  return sizeof(Lstring) + str.added;
+}
+
+std::size_t Interp::release(Heap::Kind kind, void* obj) {
+  std::size_t size = Heap::header(obj).size;
+
+  switch (kind) {
+    case Heap::Kind::CELL:
+      destroy<Cell>(obj);
+      break;
+    case Heap::Kind::LFUNC:
+      destroy<Lfunc>(obj);
+      break;
+    case Heap::Kind::LCLASS:
+      destroy<Lclass>(obj);
+      break;
+    case Heap::Kind::LINSTANCE:
+      destroy<Linstance>(obj);
+      break;
+    case Heap::Kind::LSTRING:
+      if (static_cast<Lstring*>(obj)->isInterned)
+        Lstring::erase(static_cast<Lstring*>(obj));
+      destroy<Lstring>(obj);
+      break;
+    default:
+      assert(0);
   }
+  heapSize -= size;
+  stats.free(kind, size);
+  return size;
+}
+
+bool Interp::snapshot() {
+  if (config.heapSnapshot.empty())
+    return false;
+  writeSnapshot();
+  return true;
 }
 
-void Interp::unmark() {
-  for (auto x : traced) {
-    std::visit([](auto y) -> void { y->unmarkSelf(); }, x);
+void Interp::outOfMemory() {
+  // while what filled the heap is still reachable
+  if (!config.heapSnapshot.empty()) {
+    writeSnapshot();
+    isSnapshotKept = 1;
   }
+  throw std::runtime_error("out of memory");
+}
+
+void Interp::writeStats() const {
+  std::ofstream os(config.heapStats);
+
+  stats.write(os, heapSize);
+  if (!os)
+    std::cerr << "error writing " << config.heapStats << '\n';
 }
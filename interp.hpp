@@ -1,19 +1,70 @@
 #pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
 #include <list>
+#include <memory>
+#include <mutex>
+#include <new>
 #include <optional>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <type_traits>
 #include <unordered_map>
+#include <vector>
 
+#include "chunk.hpp"
+#include "expr_fwd.hpp"
 #include "expr_visitor.hpp"
+#include "functional.hpp"
+#include "heap.hpp"
+#include "heap_stats.hpp"
 #include "interp_func_fwd.hpp"
+#include "local.hpp"
 #include "ltype.hpp"
-#include "runent.hpp"
+#include "property_cache.hpp"
 #include "stmt_visitor.hpp"
+#include "symbol.hpp"
+#include "thread_pool.hpp"
 #include "token.hpp"
 
 class Interp : public ExprVisitor, public StmtVisitor {
+ public:
+  enum class Backend { AST, BYTECODE };
+
+  // sizes in bytes
+  struct Config {
+    Backend backend;
+    // the first collection threshold, and the least one after a collection
+    std::size_t heapMin;
+    // the next threshold is the live size times this
+    double heapGrowth;
+    // allocating past this after a collection is out of memory
+    std::size_t heapMax;
+    // young objects are collected alone once they take this much
+    std::size_t heapNursery;
+    // in microseconds. If not 0, full collections are incremental, in
+    // steps of about this long interleaved with allocations
+    std::size_t heapStep;
+    // full collections mark on this many threads, the caller included
+    std::size_t heapThreads;
+    // if not empty, statistics of the collector are written to this file
+    // as JSON at exit
+    std::string heapStats;
+    // if not empty, a snapshot of the reachable objects is written to
+    // this file as JSON at exit
+    std::string heapSnapshot;
+
+    Config();
+  };
+
  private:
+  friend class Vm;
+
+  const Config config;
+
   Ltype visit(const ExprBinary* expr) final;
   Ltype visit(const ExprGrouping* expr) final;
   Ltype visit(const ExprLiteral* expr) final;
@@ -43,6 +94,7 @@ class Interp : public ExprVisitor, public StmtVisitor {
 
   Ltype eval(std::shared_ptr<const Expr> expr);
   bool equality(const Ltype& left, const Ltype& right) const;
+  bool stringEquality(StrPtr left, StrPtr right) const;
   bool floatEquality(double a, double b) const;
   bool isTruthful(const Ltype& obj) const;
   void checkNumberOperands(Token oper, const Ltype& obj) const;
@@ -61,141 +113,368 @@ class Interp : public ExprVisitor, public StmtVisitor {
 
   void handleRuntimeError(RuntimeError& ex);
 
+  // shared by both backends
+  Ltype getProperty(const Token& token, Ltype obj);
+  // what name of inst is, through the cache of the site. nullptr if inst
+  // has no such property. Entries may be replaced by the next lookup
+  const PropertyCache::Entry* lookupProperty(Symbol name,
+                                             InstPtr inst,
+                                             PropertyCache& cache);
+  // looks up through the cache of the site, nullopt where getProperty
+  // reports an error
+  std::optional<Ltype> getProperty(Symbol name,
+                                   Ltype obj,
+                                   PropertyCache& cache);
+  // inst is on the heap
+  void setProperty(InstPtr inst,
+                   Symbol name,
+                   Ltype value,
+                   PropertyCache& cache);
+  // receiver is nullptr in static methods
+  Ltype getSuper(const Token& method, ClassPtr superPtr, InstPtr receiver);
+  FunPtr checkCallable(const Token& paren, Ltype callee, std::size_t argc);
+  void checkArity(const Token& paren, FunPtr ptr, std::size_t argc);
+  void defineClass(const StmtClass& stmt, std::optional<Ltype> superObj);
+
  public:
-  class Env : public RunEnt, public Uncopyable {
+  // a variable captured by a closure, shared by the frame that declared it
+  // and the closures
+  class Cell : public Uncopyable {
    private:
     friend class Interp;
-    Env* enclosing;
-    std::unordered_map<std::string, std::optional<Ltype>> m;
+    std::optional<Ltype> value;
 
    public:
-    Env();
-    Env(Env* enclosing);
+    Cell(std::optional<Ltype> value);
+  };
 
-    void def(const Token& token, std::optional<Ltype> obj);
+  // the variables of a call, or of the top level, as a window of the slot
+  // stack. Slots are indexed by Resolver, captured variables keep a Cell in
+  // their slot instead, so scopes that capture nothing allocate nothing
+  class Frame : public Uncopyable {
+   private:
+    friend class Interp;
 
-    Ltype get(const Token& token) const;
-    Ltype assertGet(const Token& token) const;
-    Ltype getAt(const Token& token, std::size_t distance);
-    Env* ancestor(std::size_t distance);
+    Interp& interp;
+    Frame* caller;
+    // nullptr for the top level
+    Lfunc* closure;
+    std::size_t base;
+    std::size_t nSlots;
 
-    void assign(const Token& token, Ltype obj);
-    void assignAt(const Token& token, Ltype obj, std::size_t distance);
+   public:
+    Frame(Interp& interp, Lfunc* closure, std::size_t nSlots);
+    ~Frame();
   };
 
  private:
-  Env global;
-  Env* envp;
-  // is filled by Resolver and is never altered when code is run
-  std::unordered_map<const Expr*, std::size_t> locals;
+  // only the global scope is keyed by name, so the REPL can redeclare
+  // variables and refer to ones not yet declared
+  std::unordered_map<Symbol, std::optional<Ltype>> globals;
+  Frame* framep;
+
+  struct Slot {
+    std::optional<Ltype> value;
+    Cell* cell;
+  };
+  // slots of every active frame, the innermost last
+  std::vector<Slot> slots;
+  Slot& slot(std::size_t index);
+  std::optional<Ltype>& cell(std::size_t index);
+  std::optional<Ltype>& upvalue(std::size_t index);
+
+  std::optional<Ltype>& variable(const Local& local);
+  Ltype lookupVariable(const Token& token, const std::optional<Local>& local);
+  // cells are written through these, for the write barrier
+  void setCell(std::size_t index, Ltype value);
+  void setUpvalue(std::size_t index, Ltype value);
+  void setVariable(const Local& local, Ltype value);
 
  public:
-  void resolve(const Expr* expr, std::size_t distance);
+  // before obj, on the heap, is made to reference value
+  void writeBarrier(void* obj, const Ltype& value);
+  // after obj, on the heap, took bytes more of memory it owns
+  void grow(void* obj, std::size_t bytes);
+
+  // estimates of what the standard library allocates, for charging the
+  // memory objects own
+  template <typename Table>
+  static std::size_t bucketsSize(const Table& table) {
+    // an empty table has a single bucket, not allocated
+    return table.bucket_count() > 1
+               ? table.bucket_count() * sizeof(typename Table::pointer)
+               : 0;
+  }
+  // of an entry of table, without the buckets. Tables are keyed by
+  // symbols, which own nothing and whose hashes are not cached
+  template <typename Table>
+  static constexpr std::size_t entrySize() {
+    // a node links to the next one
+    return sizeof(void*) + sizeof(typename Table::value_type);
+  }
+  template <typename Table>
+  static std::size_t tableSize(const Table& table) {
+    return bucketsSize(table) + table.size() * entrySize<Table>();
+  }
 
- private:
-  Ltype lookupVariable(const Token& token, const Expr* expr);
+  // declares a variable, or a global if local is absent
+  void define(const std::optional<Local>& local,
+              const Token& token,
+              std::optional<Ltype> obj);
+  void initialize(const std::optional<Local>& local,
+                  const Token& token,
+                  Ltype obj);
 
-  using Allocated = std::variant<Env*, Lfunc*, Lclass*, Linstance*>;
-  std::list<
-      Allocated>
-      traced;
-  std::list<std::variant<Env*, Ltype>> stack;
+ private:
+  Heap heap;
+  // temporaries of the AST backend, pushed and popped by RootScope
+  std::vector<Ltype> roots;
+  // temporaries of the bytecode backend
+  std::vector<Ltype> operands;
   std::size_t heapSize;
+  // collect when heapSize would exceed it
+  std::size_t threshold;
+  // allocated since the last collection, part of heapSize
+  std::size_t youngSize;
+  // old objects that may reference young ones, by the write barrier
+  std::vector<void*> remembered;
+  // during a minor collection, which treats old objects as marked
+  bool isMinor;
+  // marked by the current full collection
+  std::size_t liveSize;
+  // garbage of the last full collection not swept yet, part of heapSize
+  std::size_t unsweptSize;
+  // of an incremental collection. While marking, marked objects are black
+  // or gray, and the write barrier shades what is stored into black ones.
+  // Objects allocated meanwhile are marked, so they survive the collection
+  enum class Phase { IDLE, MARK };
+  Phase phase;
+  HeapStats stats;
+
+  // marks the whole heap, then sets the next threshold from what is live.
+  // Only starts marking if incremental. Sweeping is lazy
+  void collect();
+  // collects young objects only, reachable from the roots or from
+  // remembered objects. Survivors are promoted
+  void collectYoung();
+  // of an incremental collection, within the time budget
+  void step();
+  // the rest of an incremental collection, and of sweeping
+  void finish();
+  void writeStats() const;
+  // rescans the roots and finishes marking at once if incremental, then
+  // frees young garbage and starts sweeping old garbage
+  void endMark();
+
+  template <typename T>
+  static constexpr Heap::Kind kindOf() {
+    if constexpr (std::is_same_v<T, Cell>)
+      return Heap::Kind::CELL;
+    else if constexpr (std::is_same_v<T, Lfunc>)
+      return Heap::Kind::LFUNC;
+    else if constexpr (std::is_same_v<T, Lclass>)
+      return Heap::Kind::LCLASS;
+    else if constexpr (std::is_same_v<T, Linstance>)
+      return Heap::Kind::LINSTANCE;
+    else {
+      static_assert(std::is_same_v<T, Lstring>);
+      return Heap::Kind::LSTRING;
+    }
+  }
 
   template <typename T, typename... Ts>
   T* doAlloc(Ts&&... args) {
+    static_assert(alignof(T) <= Heap::ALIGN && sizeof(T) <= Heap::MAX_SIZE);
+    void* mem;
     T* ret;
 
-    const std::size_t LIM = 2500;
-
-    if (heapSize + sizeof(T) >= LIM) {
-      for (auto& x : stack) {
-        if (std::holds_alternative<Env*>(x))
-          mark(std::get<Env*>(x));
-        else
-          markLtype(std::get<Ltype>(x));
+    if (phase == Phase::MARK || (config.heapStep != 0 && heap.isSweeping()))
+      step();
+    else if (heapSize - unsweptSize + sizeof(T) > threshold)
+      collect();
+    else if (youngSize + sizeof(T) > config.heapNursery)
+      collectYoung();
+    if (heapSize + sizeof(T) > config.heapMax) {
+      finish();
+      // what died during an incremental cycle survives it, only a fresh
+      // collection reclaims everything
+      if (heapSize + sizeof(T) > config.heapMax) {
+        collect();
+        finish();
       }
-
-      mark(envp);
-      reclaim();
-      unmark();
+      if (heapSize + sizeof(T) > config.heapMax)
+        outOfMemory();
     }
-    if (heapSize + sizeof(T) >= LIM)
-      throw std::runtime_error("out of memory");
 
-    ret = new T(std::forward<Ts>(args)...);
-    traced.push_back(ret);
-    heapSize += sizeof(T);
+    mem = heap.allocate(sizeof(T), kindOf<T>(), sweeper());
+    try {
+      ret = new (mem) T(std::forward<Ts>(args)...);
+    } catch (...) {
+      heap.free(mem);
+      throw;
+    }
+    Heap::header(ret).size = sizeOf(*ret);
+    heapSize += Heap::header(ret).size;
+    youngSize += Heap::header(ret).size;
+    stats.allocate(kindOf<T>(), Heap::header(ret).size, heapSize);
+    if (phase == Phase::MARK)
+      mark(ret);
 
     return ret;
   }
 
+  template <typename T>
+  static void destroy(void* obj) {
+    static_cast<T*>(obj)->~T();
+  }
+
  public:
-  class ReclaimerCtx {
+  // values added through a scope are roots until it ends. Scopes nest,
+  // ending one truncates the roots to where it began
+  class RootScope : public Uncopyable {
    public:
-    std::size_t count;
     Interp& interp;
+    const std::size_t base;
 
-    ReclaimerCtx(Interp& interp) : count(0), interp(interp) {}
+    RootScope(Interp& interp) : interp(interp), base(interp.roots.size()) {}
 
     Ltype add(Ltype l) {
-      interp.stack.push_back(l);
-      count++;
+      interp.roots.push_back(l);
       return l;
     }
 
-    ~ReclaimerCtx() {
-      std::size_t i;
-
-      for (i = 0; i < count; i++)
-        interp.stack.pop_back();
-    }
+    ~RootScope() { interp.roots.resize(base); }
   };
 
   template <typename T, typename... Ts>
-  T* alloc(ReclaimerCtx& ctx, Ts&&... args) {
+  T* alloc(RootScope& scope, Ts&&... args) {
     T* ret;
 
     ret = doAlloc<T>(std::forward<Ts>(args)...);
-    stack.push_back(ret);
-    ctx.count++;
+    scope.add(ret);
     return ret;
   }
 
+  // returns the interned string, allocating it only if it is new
+  StrPtr intern(RootScope& scope, std::string str);
+  StrPtr concat(RootScope& scope, StrPtr left, StrPtr right);
+  // captures the upvalues of funp from the current frame
+  Lfunc* closure(RootScope& scope,
+                 std::shared_ptr<const Functional> funp,
+                 bool isCtor);
+
  private:
-  // avoid overloading on Ltype
-  void markLtype(Ltype& l);
-  void mark(Lclass* lclass);
-  void mark(Linstance* obj);
-  void mark(Lfunc* func);
-  void mark(Env* env);
-  void reclaim();
-  void unmark();
-
-  void interpret(const std::list<std::shared_ptr<const Stmt>>& list);
-  void run(std::string inputStr);
+  // gray objects are marked, but what they reference may not be yet
+  std::vector<void*> gray;
+  // of a thread marking in parallel. It traces its private gray objects,
+  // sharing some when it has plenty, and steals shared ones once out
+  struct Marker {
+    std::vector<void*> gray;
+    std::mutex lock;
+    std::vector<void*> shared;
+    std::atomic<std::size_t> nShared;
+    // added to the totals once marking is done
+    std::size_t liveSize;
+    std::array<std::size_t, HeapStats::N_KINDS> marked;
+  };
+  // nullptr if marking on a single thread
+  std::unique_ptr<ThreadPool> pool;
+  std::vector<Marker> markers;
+  // markers with gray objects, marking is done once none are
+  std::atomic<std::size_t> nActive;
+  // changes when a marker shares, or once marking is done, for idle
+  // markers to wait on
+  std::atomic<std::size_t> nShares;
+
+  // how a root or an object references an object, named for heap
+  // snapshots
+  static constexpr std::size_t NO_INDEX = SIZE_MAX;
+  struct Edge {
+    std::string_view kind;
+    // of a variable, property or method, spelled out only by str()
+    Symbol name;
+    // of a slot, upvalue or temporary, if not NO_INDEX
+    std::size_t index;
+
+    std::string str() const;
+  };
 
- public:
-  // empty
-  class ControlFlow : public std::exception {};
-  class Break : public ControlFlow {};
-  class Continue : public ControlFlow {};
-  class Return : public ControlFlow {
-   public:
-    Ltype retVal;
+  // nullptr if l is not on the heap
+  static void* heapObject(const Ltype& l);
+  // call f(obj, edge) for every heap object referenced by the roots, or by
+  // obj. Shared by marking and heap snapshots
+  template <typename F>
+  void forEachRoot(F f);
+  template <typename F>
+  void forEachRef(void* obj, F f);
+  void markRoots();
+  // obj is on the heap, it turns gray unless marked already
+  void mark(void* obj);
+  // from a marker thread, during a full collection
+  void mark(void* obj, Marker& marker);
+  // marks what gray objects reference until none are left
+  void traceGray();
+  // at most n gray objects, returns whether none are left
+  bool traceGray(std::size_t n);
+  // the job of marker index, until no marker has gray objects left
+  void traceParallel(std::size_t index);
+  // moves shared gray objects of another marker, or of its own, to the
+  // marker index. Returns 0 once no marker has gray objects left
+  bool steal(std::size_t index);
+  // marks what obj references
+  void trace(void* obj);
+  // writes the objects reachable from the roots as JSON
+  void writeSnapshot();
+  // once a snapshot was written on running out of memory, kept over the
+  // one at exit, which would miss what filled the heap
+  bool isSnapshotKept;
+  // throws, after a snapshot of what filled the heap if configured
+  [[noreturn]] void outOfMemory();
+  // charged for obj when allocated
+  static std::size_t sizeOf(const Cell& cell);
+  static std::size_t sizeOf(const Lfunc& func);
+  static std::size_t sizeOf(const Lclass& lclass);
+  static std::size_t sizeOf(const Linstance& obj);
+  static std::size_t sizeOf(const Lstring& str);
+  // destroys obj, returns its size
+  std::size_t release(Heap::Kind kind, void* obj);
+  // for the sweeps of heap
+  auto releaser() {
+    return [this](Heap::Kind kind, void* obj) -> void { release(kind, obj); };
+  }
+  // for sweeping the garbage of a full collection
+  auto sweeper() {
+    return [this](Heap::Kind kind, void* obj) -> void {
+      unsweptSize -= release(kind, obj);
+    };
+  }
 
-    Return() = delete;
-    Return(Ltype retVal) : retVal(retVal) {}
-  };
+  void interpret(const std::list<std::shared_ptr<const Stmt>>& list,
+                 std::size_t nSlots);
+  void interpret(const Chunk& chunk, std::size_t nSlots);
+  void run(std::string inputStr);
 
+  // set by break, continue and return instead of throwing, the enclosing
+  // lists stop executing until a loop or a call consumes it
+  enum class Completion { NORMAL, BREAK, CONTINUE, RETURN };
+  Completion completion;
+  // with RETURN
+  Ltype retVal;
+
+ public:
   void execute(const Stmt& stmt);
-  void execute(const StmtList& stmt, Env* setEnv);
+  // consumes the completion of a function body, nil if it did not return
+  Ltype returnValue();
 
   Interp();
+  explicit Interp(Config config);
   ~Interp();
 
   void runPrompt();
   int runFile(std::string path);
+  // to the path of the heap snapshot, now. Returns whether one is
+  // configured
+  bool snapshot();
   static void testScanner(std::string inputStr);
 
   static void error(std::size_t lineNum, std::string msg);
@@ -0,0 +1,22 @@
+#pragma once
+#include <cstddef>
+
+// where Resolver found a variable, absent for globals
+struct Local {
+  // slot of the current frame, or upvalue of the current closure
+  std::size_t index;
+  bool isUpvalue;
+  // the slot holds a Cell, as the variable is captured by a closure.
+  // Upvalues are always boxed
+  bool isBoxed;
+};
+
+// how a closure captures a variable when it is created
+struct Upvalue {
+  // from a slot of the enclosing frame, otherwise from an upvalue of the
+  // enclosing closure
+  bool isLocal;
+  std::size_t index;
+
+  bool operator==(const Upvalue& rhs) const = default;
+};
@@ -1,6 +1,10 @@
 #include <string>
+#include <string_view>
+#include <unordered_set>
 #include <variant>
 
+#include "func.hpp"
+
 #include "ltype.hpp"
 
 std::string literalToString(const Literal& l) {
@@ -25,7 +29,7 @@ Ltype literalToLtype(const Literal& l) {
   static_assert(2 == std::variant_size_v<Literal>);
   switch (l.index()) {
     case 0:
-      value = Lstring(std::get<std::string>(l));
+      value = Lstring::constant(std::get<std::string>(l));
       break;
     case 1:
       value = std::get<double>(l);
@@ -39,36 +43,35 @@ std::string valueToString(const Ltype& l) {
   std::string s;
   std::size_t pos;
 
-  static_assert(8 == std::variant_size_v<Ltype>);
-  switch (l.index()) {
-    case 0:
-      s = std::string(std::get<Lstring>(l));
+  switch (l.type()) {
+    case Ltype::Type::STRING:
+      s = std::string(l.get<StrPtr>()->view());
       break;
-    case 1:
-      s = std::to_string(std::get<double>(l));
+    case Ltype::Type::NUMBER:
+      s = std::to_string(l.get<double>());
       pos = s.find_last_not_of('0');
       if (s[pos] == '.')
         pos--;
       s = s.substr(0, pos + 1);
       break;
-    case 2:
-      if (std::get<bool>(l) == false)
+    case Ltype::Type::BOOL:
+      if (l.get<bool>() == false)
         s = std::string("false");
       else
         s = std::string("true");
       break;
-    case 3:
+    case Ltype::Type::NIL:
       s = std::string("nil");
       break;
-    case 4:
+    case Ltype::Type::FUN:
       [[fallthrough]];
-    case 5:
+    case Ltype::Type::LFUN:
       s = std::string("function");
       break;
-    case 6:
+    case Ltype::Type::INST:
       s = std::string("object");
       break;
-    case 7:
+    case Ltype::Type::CLASS:
       s = std::string("class");
       break;
   }
@@ -79,33 +82,156 @@ std::string valueToString(const Ltype& l) {
 std::string typeToString(const Ltype& l) {
   static const char* t[] = {"string",   "number",   "bool",   "nil",
                             "function", "function", "object", "class"};
-  static_assert(sizeof(t) / sizeof(t[0]) == std::variant_size_v<Ltype>);
+  static_assert(sizeof(t) / sizeof(t[0]) ==
+                (std::size_t)Ltype::Type::CLASS + 1);
 
-  return std::string(t[l.index()]);
+  return std::string(t[(std::size_t)l.type()]);
 }
 
-Lstring::Lstring(std::string&& str) : str(std::move(str)) {}
+FunPtr Ltype::getCallable() const {
+  switch (t) {
+    case Type::FUN:
+      return fun;
+    case Type::LFUN:
+      return lfun;
+    case Type::CLASS:
+      return lclass;
+    default:
+      return nullptr;
+  }
+}
 
-Lstring::Lstring(const std::string& str) : str(str) {}
+namespace {
+// of the block make_shared allocates for a buffer: a vtable pointer, two
+// counts and the std::string
+const std::size_t SHARED_SIZE =
+    sizeof(void*) + 2 * sizeof(int) + sizeof(std::string);
 
-Lstring& Lstring::operator=(const Lstring& rhs) {
-  str = rhs.str;
-  return *this;
+// allocated by str beyond itself, short strings are stored inline
+std::size_t capacitySize(const std::string& str) {
+  return str.capacity() > std::string().capacity() ? str.capacity() + 1 : 0;
 }
 
-Lstring& Lstring::operator=(Lstring&& rhs) {
-  str = std::move(rhs.str);
-  return *this;
+struct StringHash {
+  using is_transparent = void;
+
+  std::size_t operator()(std::string_view str) const noexcept {
+    return std::hash<std::string_view>()(str);
+  }
+  // rehashing the table never touches string contents
+  std::size_t operator()(const Lstring* str) const noexcept {
+    return str->hashCode();
+  }
+};
+
+struct StringEqual {
+  using is_transparent = void;
+
+  bool operator()(const Lstring* lhs, const Lstring* rhs) const noexcept {
+    return lhs == rhs;
+  }
+  bool operator()(std::string_view lhs, const Lstring* rhs) const noexcept {
+    return lhs == rhs->view();
+  }
+  bool operator()(const Lstring* lhs, std::string_view rhs) const noexcept {
+    return lhs->view() == rhs;
+  }
+};
+
+class StringTable : public Uncopyable {
+ public:
+  std::unordered_set<Lstring*, StringHash, StringEqual> set;
+
+  StringTable() = default;
+
+  // by now the interpreter has reclaimed every runtime string
+  ~StringTable() {
+    for (Lstring* str : set)
+      delete str;
+  }
+};
+
+StringTable& table() {
+  static StringTable t;
+
+  return t;
+}
+}  // namespace
+
+Lstring::Lstring(std::string str)
+    : buf(std::make_shared<std::string>(std::move(str))),
+      length(buf->size()),
+      added(SHARED_SIZE + capacitySize(*buf)),
+      hash(0),
+      isHashed(0),
+      isInterned(0),
+      isConstant(0) {}
+
+Lstring::Lstring(const Lstring* left, const Lstring* right)
+    : buf(!left->isConstant && left->buf->size() == left->length
+              ? left->buf
+              : std::make_shared<std::string>(left->view())),
+      length(left->length + right->length),
+      added(0),
+      hash(0),
+      isHashed(0),
+      isInterned(0),
+      isConstant(0) {
+  const bool isShared = buf == left->buf;
+  const std::size_t before = isShared ? capacitySize(*buf) : 0;
+
+  // s + s, appending may move what right views
+  if (right->buf == buf)
+    buf->append(std::string(right->view()));
+  else
+    buf->append(right->view());
+  added = capacitySize(*buf) - before + (isShared ? 0 : SHARED_SIZE);
+}
+
+Lstring* Lstring::find(std::string_view str) {
+  auto it = table().set.find(str);
+  if (it == table().set.end())
+    return nullptr;
+  return *it;
 }
 
-Lstring::operator std::string() const {
-  return str;
+void Lstring::insert(Lstring* str) {
+  table().set.insert(str);
+  str->isInterned = 1;
 }
 
-Lstring Lstring::operator+(const Lstring& rhs) const {
-  return Lstring(str + rhs.str);
+void Lstring::erase(Lstring* str) {
+  table().set.erase(str);
+  str->isInterned = 0;
 }
 
-bool Lstring::operator==(const Lstring& rhs) const {
-  return str == rhs.str;
+Lstring* Lstring::constant(std::string str) {
+  Lstring* ret;
+
+  if ((ret = find(str)) != nullptr && ret->isConstant)
+    return ret;
+  // one created at run time lives on the heap, it stays equal to the
+  // constant by contents once no longer interned
+  if (ret != nullptr)
+    erase(ret);
+  ret = new Lstring(std::move(str));
+  ret->isConstant = 1;
+  insert(ret);
+  return ret;
+}
+
+std::string_view Lstring::view() const {
+  return std::string_view(buf->data(), length);
+}
+
+std::size_t Lstring::size() const {
+  return length;
+}
+
+std::size_t Lstring::hashCode() const {
+  if (!isHashed) {
+    hash = StringHash()(view());
+    isHashed = 1;
+  }
+  return hash;
 }
@@ -1,38 +1,162 @@
 #pragma once
+#include <cassert>
+#include <cstddef>
 #include <memory>
 #include <string>
+#include <string_view>
 #include <variant>
 
 #include "interp_func_fwd.hpp"
+#include "uncopyable.hpp"
 
 // nil
 class Lnil {};
 
-class Lstring {
+// immutable. Contents are the first length bytes of a buffer that may be
+// shared with longer strings built by appending to this one, which makes
+// repeated concatenation amortized linear. Strings below a small size are
+// interned: equal contents share one Lstring, so they compare by pointer.
+// Runtime strings are allocated through Interp::doAlloc, string literals
+// are constants owned by the intern table, outside the collected heap
+class Lstring : public Uncopyable {
  private:
-  std::string str;
+  friend class Interp;
+
+  std::shared_ptr<std::string> buf;
+  const std::size_t length;
+  // bytes this string allocated for buf: all of it if the string made
+  // it, what it grew by if the string appended to it
+  std::size_t added;
+  mutable std::size_t hash;
+  mutable bool isHashed;
+  bool isInterned;
+  // referenced from the AST, never reclaimed
+  bool isConstant;
 
  public:
-  Lstring() = default;
-  Lstring(const Lstring& rhs) = default;
-  Lstring(Lstring&& rhs) = default;
-  Lstring& operator=(const Lstring& rhs);
-  Lstring& operator=(Lstring&& rhs);
-  explicit Lstring(const std::string& str);
-  explicit Lstring(std::string&& str);
-  explicit operator std::string() const;
-  Lstring operator+(const Lstring& rhs) const;
-  bool operator==(const Lstring& rhs) const;
-  ~Lstring() = default;
+  explicit Lstring(std::string str);
+  // left followed by right, appends to the buffer of left if nothing was
+  // appended to it yet and left is not a constant, whose buffer would
+  // outlive the heap
+  Lstring(const Lstring* left, const Lstring* right);
+  Lstring() = delete;
+
+  static Lstring* find(std::string_view str);
+  static void insert(Lstring* str);
+  static void erase(Lstring* str);
+  // intern a string literal
+  static Lstring* constant(std::string str);
+
+  std::string_view view() const;
+  std::size_t size() const;
+  std::size_t hashCode() const;
 };
 
 using Literal = std::variant<std::string, double>;
+using StrPtr = Lstring*;
 using FunPtr = Func*;
 using InstPtr = Linstance*;
 using ClassPtr = Lclass*;
 using LfunPtr = Lfunc*;
-using Ltype = std::
-    variant<Lstring, double, bool, Lnil, FunPtr, LfunPtr, InstPtr, ClassPtr>;
+
+// tagged union of every runtime value, two machine words wide
+class Ltype {
+ public:
+  // order matches typeToString
+  enum class Type : unsigned char {
+    STRING = 0,
+    NUMBER,
+    BOOL,
+    NIL,
+    FUN,
+    LFUN,
+    INST,
+    CLASS
+  };
+
+ private:
+  Type t;
+  union {
+    StrPtr str;
+    double num;
+    bool boolean;
+    FunPtr fun;
+    LfunPtr lfun;
+    InstPtr inst;
+    ClassPtr lclass;
+  };
+
+ public:
+  Ltype() : t(Type::NIL), num(0) {}
+  Ltype(Lnil) : t(Type::NIL), num(0) {}
+  Ltype(double num) : t(Type::NUMBER), num(num) {}
+  Ltype(bool boolean) : t(Type::BOOL), boolean(boolean) {}
+  Ltype(StrPtr str) : t(Type::STRING), str(str) {}
+  Ltype(FunPtr fun) : t(Type::FUN), fun(fun) {}
+  Ltype(LfunPtr lfun) : t(Type::LFUN), lfun(lfun) {}
+  Ltype(InstPtr inst) : t(Type::INST), inst(inst) {}
+  Ltype(ClassPtr lclass) : t(Type::CLASS), lclass(lclass) {}
+
+  Type type() const { return t; }
+
+  template <typename T>
+  static constexpr Type typeOf() {
+    if constexpr (std::is_same_v<T, StrPtr>)
+      return Type::STRING;
+    else if constexpr (std::is_same_v<T, double>)
+      return Type::NUMBER;
+    else if constexpr (std::is_same_v<T, bool>)
+      return Type::BOOL;
+    else if constexpr (std::is_same_v<T, Lnil>)
+      return Type::NIL;
+    else if constexpr (std::is_same_v<T, FunPtr>)
+      return Type::FUN;
+    else if constexpr (std::is_same_v<T, LfunPtr>)
+      return Type::LFUN;
+    else if constexpr (std::is_same_v<T, InstPtr>)
+      return Type::INST;
+    else {
+      static_assert(std::is_same_v<T, ClassPtr>);
+      return Type::CLASS;
+    }
+  }
+
+  template <typename T>
+  bool is() const {
+    return t == typeOf<T>();
+  }
+
+  template <typename T>
+  T get() const {
+    assert(is<T>());
+    if constexpr (std::is_same_v<T, StrPtr>)
+      return str;
+    else if constexpr (std::is_same_v<T, double>)
+      return num;
+    else if constexpr (std::is_same_v<T, bool>)
+      return boolean;
+    else if constexpr (std::is_same_v<T, Lnil>)
+      return Lnil();
+    else if constexpr (std::is_same_v<T, FunPtr>)
+      return fun;
+    else if constexpr (std::is_same_v<T, LfunPtr>)
+      return lfun;
+    else if constexpr (std::is_same_v<T, InstPtr>)
+      return inst;
+    else
+      return lclass;
+  }
+
+  // natives, user functions and classes can all be called
+  bool isCallable() const {
+    return t == Type::FUN || t == Type::LFUN || t == Type::CLASS;
+  }
+
+  FunPtr getCallable() const;
+};
+
+static_assert(sizeof(Ltype) <= 16);
+static_assert(std::is_trivially_copyable_v<Ltype>);
 
 std::string literalToString(const Literal& l);
 Ltype literalToLtype(const Literal& l);
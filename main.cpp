@@ -1,23 +1,135 @@
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
 #include <iostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
 
 #include "interp.hpp"
 
+[[noreturn]] static void usage(std::string_view msg) {
+  std::cerr << msg << '\n';
+  std::exit(1);
+}
+
+static std::size_t parseSize(std::string_view name,
+                             std::string str,
+                             std::string_view what = "a size in bytes") {
+  std::size_t pos, ret;
+
+  try {
+    ret = std::stoull(str, &pos);
+  } catch (std::exception&) {
+    pos = 0;
+  }
+  if (pos == 0 || pos != str.size() || str[0] == '-')
+    usage(std::string(name) + ": expected " + std::string(what) + ", got '" +
+          str + "'");
+  return ret;
+}
+
+static double parseFactor(std::string_view name, std::string str) {
+  std::size_t pos;
+  double ret;
+
+  try {
+    ret = std::stod(str, &pos);
+  } catch (std::exception&) {
+    pos = 0;
+  }
+  if (pos == 0 || pos != str.size() || !(ret >= 1) || !std::isfinite(ret))
+    usage(std::string(name) +
+          ": expected a finite factor of at least 1, got '" + str + "'");
+  return ret;
+}
+
+// from the environment, overridden by options. isMinSet tells whether
+// heapMin was given
+static void heapOption(Interp::Config& config,
+                       bool& isMinSet,
+                       std::string_view name,
+                       std::string value) {
+  if (name == "heap-min" || name == "LOX_HEAP_MIN") {
+    config.heapMin = parseSize(name, value);
+    isMinSet = true;
+  } else if (name == "heap-max" || name == "LOX_HEAP_MAX")
+    config.heapMax = parseSize(name, value);
+  else if (name == "heap-nursery" || name == "LOX_HEAP_NURSERY")
+    config.heapNursery = parseSize(name, value);
+  else if (name == "heap-step" || name == "LOX_HEAP_STEP")
+    config.heapStep = parseSize(name, value, "a time in microseconds");
+  else if (name == "heap-threads" || name == "LOX_HEAP_THREADS")
+    config.heapThreads = parseSize(name, value, "a thread count");
+  else if (name == "heap-stats" || name == "LOX_HEAP_STATS")
+    config.heapStats = value;
+  else if (name == "heap-snapshot" || name == "LOX_HEAP_SNAPSHOT")
+    config.heapSnapshot = value;
+  else
+    config.heapGrowth = parseFactor(name, value);
+}
+
 int main(int argc, char* argv[]) {
-  Interp i;
-  int ret;
-
-  switch (argc) {
-    case 1:
-      i.runPrompt();
-      ret = 0;
-      break;
-    case 2:
-      ret = i.runFile(argv[1]);
-      break;
-    default:
-      std::cerr << "argc = " << argc << '\n';
-      std::exit(1);
-      break;
+  Interp::Config config;
+  int ret, argi;
+  bool isMinSet = false;
+
+  for (const char* name : {"LOX_HEAP_MIN", "LOX_HEAP_GROWTH", "LOX_HEAP_MAX",
+                           "LOX_HEAP_NURSERY", "LOX_HEAP_STEP",
+                           "LOX_HEAP_THREADS", "LOX_HEAP_STATS",
+                           "LOX_HEAP_SNAPSHOT"}) {
+    if (const char* value = std::getenv(name))
+      heapOption(config, isMinSet, name, value);
+  }
+
+  // options come before the file
+  for (argi = 1; argi < argc && std::string_view(argv[argi]).starts_with("--");
+       argi++) {
+    std::string_view opt(argv[argi]);
+    std::size_t eq = opt.find('=');
+    std::string_view name = opt.substr(2, eq - 2);
+
+    if (opt == "--bytecode")
+      config.backend = Interp::Backend::BYTECODE;
+    else if (eq != std::string_view::npos &&
+             (name == "heap-min" || name == "heap-growth" ||
+              name == "heap-max" || name == "heap-nursery" ||
+              name == "heap-step" || name == "heap-threads" ||
+              name == "heap-stats" || name == "heap-snapshot"))
+      heapOption(config, isMinSet, name, std::string(opt.substr(eq + 1)));
+    else
+      usage("unknown option: " + std::string(opt));
+  }
+  // the default gives way to a smaller heap-max
+  if (config.heapMin > config.heapMax) {
+    if (isMinSet)
+      usage("heap-min is above heap-max");
+    config.heapMin = config.heapMax;
+  }
+  if (config.heapThreads == 0)
+    usage("heap-threads: expected at least 1 thread");
+
+  Interp i(config);
+
+  // like running out of memory. The interpreter is still destroyed, so
+  // what it writes at exit is written
+  try {
+    switch (argc - argi) {
+      case 0:
+        i.runPrompt();
+        ret = 0;
+        break;
+      case 1:
+        ret = i.runFile(argv[argi]);
+        break;
+      default:
+        std::cerr << "argc = " << argc << '\n';
+        std::exit(1);
+        break;
+    }
+  } catch (std::runtime_error& ex) {
+    std::cerr << ex.what() << '\n';
+    ret = 1;
   }
 
   return ret;
@@ -549,7 +549,7 @@ std::unique_ptr<const Stmt> Parser::definitionClass() {
     if (previous().type == FUN) {
       funp = definitionFun();
       // if optional ctor
-      if (funp->token.lexeme == token.lexeme)
+      if (funp->token.symbol == token.symbol)
         ctor = std::move(funp);
       else
         methods.push_back(std::move(funp));
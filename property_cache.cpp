@@ -0,0 +1,13 @@
+#include <cstddef>
+
+#include "property_cache.hpp"
+
+PropertyCache::PropertyCache() : entries{}, victim(0) {}
+
+const PropertyCache::Entry& PropertyCache::add(Entry entry) {
+  Entry& ret = entries[victim];
+
+  victim = (victim + 1) % N_ENTRIES;
+  ret = entry;
+  return ret;
+}
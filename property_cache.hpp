@@ -0,0 +1,71 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#include "interp_func_fwd.hpp"
+#include "shape.hpp"
+
+// of a site getting or setting a property, what the lookups for the last
+// few kinds of receivers found. Classes are told apart by id, as a class
+// may be freed and another allocated at its address
+class PropertyCache {
+ public:
+  static constexpr std::size_t N_ENTRIES = 4;
+
+  enum class Kind : unsigned char {
+    NONE,
+    // the field at index of shape
+    FIELD,
+    // a method of instances of shape and of the class
+    METHOD,
+    // a method of the class
+    STATIC,
+    // setting a new field, at index of next
+    ADD
+  };
+
+  struct Entry {
+    Kind kind;
+    const Shape* shape;
+    std::uint64_t classId;
+    std::size_t index;
+    const Shape* next;
+    Lfunc* method;
+  };
+
+ private:
+  Entry entries[N_ENTRIES];
+  // replaced by the next entry added
+  std::size_t victim;
+
+ public:
+  PropertyCache();
+
+  // nullptr if missing
+  const Entry* findGet(const Shape* shape, std::uint64_t classId) const {
+    for (const Entry& entry : entries) {
+      if (entry.shape == shape &&
+          (entry.kind == Kind::FIELD ||
+           (entry.kind == Kind::METHOD && entry.classId == classId)))
+        return &entry;
+    }
+    return nullptr;
+  }
+  const Entry* findStatic(std::uint64_t classId) const {
+    for (const Entry& entry : entries) {
+      if (entry.kind == Kind::STATIC && entry.classId == classId)
+        return &entry;
+    }
+    return nullptr;
+  }
+  const Entry* findSet(const Shape* shape) const {
+    for (const Entry& entry : entries) {
+      if (entry.shape == shape &&
+          (entry.kind == Kind::FIELD || entry.kind == Kind::ADD))
+        return &entry;
+    }
+    return nullptr;
+  }
+
+  const Entry& add(Entry entry);
+};
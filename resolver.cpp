@@ -1,13 +1,16 @@
+#include <algorithm>
 #include <list>
 #include <memory>
 #include <optional>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include "expr.hpp"
 #include "interp.hpp"
 #include "ltype.hpp"
 #include "stmt.hpp"
+#include "symbol.hpp"
 
 #include "resolver.hpp"
 
@@ -74,9 +77,9 @@ Ltype Resolver::visit(const ExprTern* expr) {
 }
 
 Ltype Resolver::visit(const ExprVar* expr) {
-  auto optIt = resolveLocal(expr, expr->token);
+  auto optIt = resolveLocal(expr->local, expr->token);
   if (!scopes.empty()) {
-    if (optIt.has_value() && optIt.value()->second == VarState::DECL)
+    if (optIt.has_value() && optIt.value()->second.state == VarState::DECL)
       Interp::error(expr->token,
                     "static: "
                     "uninitialized variable");
@@ -90,9 +93,9 @@ Ltype Resolver::visit(const ExprVar* expr) {
 Ltype Resolver::visit(const ExprAssign* expr) {
   resolve(expr->exprp);
 
-  auto optIt = resolveLocal(expr, expr->token);
-  if (optIt.has_value() && optIt.value()->second != VarState::READ)
-    optIt.value()->second = VarState::SET;
+  auto optIt = resolveLocal(expr->local, expr->token);
+  if (optIt.has_value() && optIt.value()->second.state != VarState::READ)
+    optIt.value()->second.state = VarState::SET;
   return Lnil();
 }
 
@@ -119,7 +122,7 @@ Ltype Resolver::visit(const ExprThis* expr) {
     Interp::error(expr->token, "outside method scope");
   if (isScopeType(STATIC_METHOD))
     Interp::error(expr->token, "in static method");
-  resolveLocal(expr, expr->token);
+  resolveLocal(expr->local, expr->token);
   return Lnil();
 }
 
@@ -128,7 +131,11 @@ Ltype Resolver::visit(const ExprSuper* expr) {
     Interp::error(expr->token, "outside method scope");
   else if (!isScopeType(SUBCLASS))
     Interp::error(expr->token, "class does not have an ancestor");
-  resolveLocal(expr, expr->token);
+  resolveLocal(expr->local, expr->token);
+  // binds methods of the superclass, static methods have nothing to bind
+  if (!isScopeType(STATIC_METHOD))
+    resolveLocal(expr->thisLocal, Token(Token::Type::THIS, "this", "", 0,
+                                        Symbols::intern("this")));
   return Lnil();
 }
 
@@ -141,7 +148,7 @@ void Resolver::visit(const StmtPrint& stmt) {
 }
 
 void Resolver::visit(const StmtVar& stmt) {
-  declare(stmt.token);
+  declare(stmt.token, stmt.local);
   if (stmt.exprp != nullptr) {
     resolve(stmt.exprp);
     initialize(stmt.token);
@@ -192,11 +199,11 @@ void Resolver::visit(const StmtLoopFlow& stmt) {
 void Resolver::visit(const StmtClass& stmt) {
   ExchangeScopeTypes once(*this);
 
-  declare(stmt.token);
+  declare(stmt.token, stmt.local);
   initialize(stmt.token);
 
   if (stmt.superExpr != nullptr) {
-    if (stmt.superExpr->token.lexeme == stmt.token.lexeme)
+    if (stmt.superExpr->token.symbol == stmt.token.symbol)
       Interp::error(stmt.superExpr->token, "inherits from itself");
     else
       resolve(stmt.superExpr);
@@ -204,26 +211,28 @@ void Resolver::visit(const StmtClass& stmt) {
 
   once.add(FUNC | METHOD | CLASS);
   if (stmt.superExpr != nullptr) {
+    Token super(Token::Type::SUPER, "super", "", 0,
+                Symbols::intern("super"));
+
     once.add(SUBCLASS);
+    // a variable of the enclosing function, captured by the methods
     beginScope();
-    (scopes.back())[Token(Token::Type::SUPER, "super", "", 0)] = VarState::READ;
+    declare(super, stmt.superLocal);
+    scopes.back().vars.at(super).state = VarState::READ;
   }
-  beginScope();
-  (scopes.back())[Token(Token::Type::THIS, "this", "", 0)] = VarState::READ;
   if (stmt.ctor != nullptr) {
     ExchangeScopeTypes twice(*this);
     twice.add(CTOR);
-    resolveFunctional(*stmt.ctor);
+    resolveFunctional(*stmt.ctor, true);
   }
   for (const auto& ptr : stmt.methods)
-    resolveFunctional(*ptr);
-  endScope();
+    resolveFunctional(*ptr, true);
 
   once.add(STATIC_METHOD);
   for (const auto& ptr : stmt.staticMethods) {
-    if (ptr->token.lexeme == stmt.token.lexeme)
+    if (ptr->token.symbol == stmt.token.symbol)
       Interp::error(ptr->token, "constructor defined as a static method");
-    resolveFunctional(*ptr);
+    resolveFunctional(*ptr, false);
   }
   if (stmt.superExpr != nullptr)
     endScope();
@@ -234,7 +243,11 @@ void Resolver::resolve(const std::list<std::shared_ptr<const Stmt>>& list) {
     resolve(*ptr);
 }
 
-Resolver::Resolver(Interp& interp) : currentScopeType(NONE), interp(interp) {}
+std::size_t Resolver::nSlots() const {
+  return functions.front().maxSlots;
+}
+
+Resolver::Resolver() : functions{{0, 0, nullptr}}, currentScopeType(NONE) {}
 
 void Resolver::resolve(const Stmt& stmt) {
   stmt.accept(*this);
@@ -245,38 +258,69 @@ Ltype Resolver::resolve(std::shared_ptr<const Expr> expr) {
   return Lnil();
 }
 
-void Resolver::resolveFunctional(const Functional& fun) {
+void Resolver::resolveFunctional(const Functional& fun, bool hasThis) {
   ExchangeScopeTypes once(*this);
+  std::size_t i;
 
   once.add(FUNC);
+  beginFunction(fun);
+  if (hasThis) {
+    Token self(Token::Type::THIS, "this", "", 0, Symbols::intern("this"));
+
+    beginScope();
+    declare(self, fun.thisLocal);
+    scopes.back().vars.at(self).state = VarState::READ;
+  }
   beginScope();
+  fun.paramLocals.resize(fun.params.size());
+  i = 0;
   for (const auto& token : fun.params) {
-    declare(token);
+    declare(token, fun.paramLocals[i++]);
     initialize(token);
   }
 
   resolve(fun.listp->stmts);
   endScope();
+  if (hasThis)
+    endScope();
+  endFunction(fun);
 }
 
 Ltype Resolver::visit(std::shared_ptr<const ExprFun> expr) {
-  resolveFunctional(*expr);
+  resolveFunctional(*expr, false);
   return Lnil();
 }
 
 void Resolver::visit(std::shared_ptr<const StmtFun> stmtp) {
-  declare(stmtp->token);
+  declare(stmtp->token, stmtp->local);
   initialize(stmtp->token);
-  resolveFunctional(*stmtp);
+  resolveFunctional(*stmtp, false);
 }
 
 void Resolver::beginScope() {
-  scopes.push_back(std::unordered_map<Token, VarState, Token::Hash>{});
+  scopes.push_back(Scope{Vars{}, functions.size() - 1});
+}
+
+void Resolver::beginFunction(const Functional& fun) {
+  fun.upvalues.clear();
+  functions.push_back(FunctionCtx{0, 0, &fun.upvalues});
+}
+
+void Resolver::endFunction(const Functional& fun) {
+  fun.nSlots = functions.back().maxSlots;
+  functions.pop_back();
 }
 
 void Resolver::endScope() {
-  for (const auto& [token, state] : scopes.back()) {
-    switch (state) {
+  for (auto& [_, var] : scopes.back().vars) {
+    if (var.isCaptured) {
+      for (Local* site : var.sites)
+        site->isBoxed = 1;
+    }
+  }
+  functions.back().slots -= scopes.back().vars.size();
+  for (const auto& [token, var] : scopes.back().vars) {
+    switch (var.state) {
       case VarState::DECL:
         Interp::report(token, "declared but not used");
         break;
@@ -290,43 +334,82 @@ void Resolver::endScope() {
   scopes.pop_back();
 }
 
-void Resolver::declare(const Token& token) {
+void Resolver::declare(const Token& token, std::optional<Local>& local) {
+  std::size_t slot;
+
   // not global
   if (!scopes.empty()) {
-    auto it = scopes.back().find(token);
-    if (it != scopes.back().end()) {
+    FunctionCtx& fun = functions.back();
+    Vars& vars = scopes.back().vars;
+
+    slot = fun.slots;
+    auto it = vars.find(token);
+    if (it != vars.end()) {
       Interp::error(token,
                     "static: "
                     "redeclaration in non-global scope");
       Interp::error(it->first,
                     "static: "
                     "previously declared here");
+      slot = it->second.slot;
+    } else {
+      fun.slots++;
+      fun.maxSlots = std::max(fun.maxSlots, fun.slots);
     }
-    (scopes.back())[token] = VarState::DECL;
+    local = Local{slot, 0, 0};
+    vars[token] = {VarState::DECL, slot, 0, {&local.value()}};
   }
 }
 
 void Resolver::initialize(const Token& token) {
   if (!scopes.empty())
-    (scopes.back())[token] = VarState::SET;
+    scopes.back().vars.at(token).state = VarState::SET;
 }
 
-std::optional<decltype(Resolver::scopes)::value_type::iterator>
-Resolver::resolveLocal(const Expr* expr, const Token& token) {
-  std::size_t count;
+std::size_t Resolver::addUpvalue(std::size_t function, Upvalue upvalue) {
+  std::vector<Upvalue>& upvalues = *functions[function].upvalues;
+
+  auto it = std::find(upvalues.begin(), upvalues.end(), upvalue);
+  if (it != upvalues.end())
+    return (std::size_t)(it - upvalues.begin());
+  upvalues.push_back(upvalue);
+  return upvalues.size() - 1;
+}
+
+std::optional<Resolver::Vars::iterator> Resolver::resolveLocal(
+    std::optional<Local>& local,
+    const Token& token) {
+  std::size_t index, function;
+  bool isLocal;
   auto sb = scopes.rbegin();
   auto se = scopes.rend();
 
   // leaves names in global uninspected
-  for (count = 0; sb != se; count++, sb++) {
-    auto it = sb->find(token);
-    if (it != sb->end()) {
-      // methods are always SET, thus they are always READ
-      if (it->second == VarState::SET)
-        it->second = VarState::READ;
-      interp.resolve(expr, count);
+  for (; sb != se; sb++) {
+    auto it = sb->vars.find(token);
+    if (it == sb->vars.end())
+      continue;
+    // methods are always SET, thus they are always READ
+    if (it->second.state == VarState::SET)
+      it->second.state = VarState::READ;
+
+    if (sb->function == functions.size() - 1) {
+      local = Local{it->second.slot, 0, 0};
+      it->second.sites.push_back(&local.value());
       return it;
     }
+    // declared in an enclosing function, every function in between
+    // passes it down as an upvalue
+    it->second.isCaptured = 1;
+    index = it->second.slot;
+    isLocal = 1;
+    for (function = sb->function + 1; function < functions.size();
+         function++) {
+      index = addUpvalue(function, Upvalue{isLocal, index});
+      isLocal = 0;
+    }
+    local = Local{index, 1, 1};
+    return it;
   }
 
   return std::nullopt;
@@ -1,11 +1,15 @@
 #pragma once
+#include <cstddef>
 #include <list>
 #include <memory>
 #include <optional>
 #include <unordered_map>
+#include <vector>
 
+#include "expr_fwd.hpp"
 #include "expr_visitor.hpp"
 #include "interp_func_fwd.hpp"
+#include "local.hpp"
 #include "ltype.hpp"
 #include "stmt_visitor.hpp"
 #include "token.hpp"
@@ -22,7 +26,8 @@ class Resolver : public ExprVisitor, public StmtVisitor {
   void visit(const StmtLoopFlow& stmt) final;
   void visit(std::shared_ptr<const StmtFun> stmtp) final;
   void visit(const StmtClass& stmt) final;
-  void resolveFunctional(const Functional& fun);
+  // hasThis -- instance methods and ctors receive 'this' in slot 0
+  void resolveFunctional(const Functional& fun, bool hasThis);
 
   Ltype visit(const ExprBinary* expr) final;
   Ltype visit(const ExprGrouping* expr) final;
@@ -42,11 +47,42 @@ class Resolver : public ExprVisitor, public StmtVisitor {
 
   enum class VarState { DECL, SET, READ };
 
-  std::list<std::unordered_map<Token, VarState, Token::Hash>> scopes;
+  struct Variable {
+    VarState state;
+    // index in the frame of the declaring function. Slots of a scope are
+    // reused by the scopes that follow it
+    std::size_t slot;
+    // referred to from a nested function, so it lives in a Cell
+    bool isCaptured;
+    // accesses from the declaring function, boxed at the end of the scope
+    // if captured
+    std::vector<Local*> sites;
+  };
+  using Vars = std::unordered_map<Token, Variable, Token::Hash>;
+
+  struct Scope {
+    Vars vars;
+    // index in functions
+    std::size_t function;
+  };
+
+  struct FunctionCtx {
+    std::size_t slots;
+    std::size_t maxSlots;
+    // nullptr for the top level
+    std::vector<Upvalue>* upvalues;
+  };
+
+  std::list<Scope> scopes;
+  // the top level, then the functions enclosing the current scope
+  std::vector<FunctionCtx> functions;
   void beginScope();
   void endScope();
-  void declare(const Token& token);
+  void beginFunction(const Functional& fun);
+  void endFunction(const Functional& fun);
+  void declare(const Token& token, std::optional<Local>& local);
   void initialize(const Token& token);
+  std::size_t addUpvalue(std::size_t function, Upvalue upvalue);
 
  public:
   enum class ScopeType : int {
@@ -79,14 +115,13 @@ class Resolver : public ExprVisitor, public StmtVisitor {
 
   Ltype resolve(std::shared_ptr<const Expr> expr);
   void resolve(const Stmt& stmt);
-  std::optional<decltype(Resolver::scopes)::value_type::iterator> resolveLocal(
-      const Expr* expr,
-      const Token& token);
-
-  Interp& interp;
+  std::optional<Vars::iterator> resolveLocal(std::optional<Local>& local,
+                                            const Token& token);
 
  public:
   void resolve(const std::list<std::shared_ptr<const Stmt>>& list);
+  // size of the frame of the top level
+  std::size_t nSlots() const;
 
-  Resolver(Interp& interp);
+  Resolver();
 };
@@ -4,6 +4,7 @@
 
 #include "interp.hpp"
 #include "ltype.hpp"
+#include "symbol.hpp"
 #include "token.hpp"
 
 #include "scanner.hpp"
@@ -186,6 +187,10 @@ void Scanner::addToken(Token::Type tt) {
 }
 
 void Scanner::addToken(Token::Type tt, Literal literal) {
-  tokenList.push_back(
-      Token(tt, input.substr(start, current - start), literal, lineNum));
+  std::string lexeme = input.substr(start, current - start);
+  Symbol symbol = Symbols::NONE;
+
+  if (tt == IDENTIFIER || tt == THIS || tt == SUPER)
+    symbol = Symbols::intern(lexeme);
+  tokenList.push_back(Token(tt, lexeme, literal, lineNum, symbol));
 }
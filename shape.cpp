@@ -0,0 +1,49 @@
+#include <cstddef>
+#include <memory>
+#include <optional>
+
+#include "shape.hpp"
+
+Shape::Shape(const Shape* parent, Symbol name)
+    : parent(parent),
+      name(name),
+      nFields(parent == nullptr ? 0 : parent->nFields + 1),
+      transitions{},
+      indexes{} {}
+
+const Shape* Shape::empty() {
+  static Shape shape(nullptr, Symbols::NONE);
+
+  return &shape;
+}
+
+std::optional<std::size_t> Shape::find(Symbol name) const {
+  // comparing a few symbols beats hashing one
+  const std::size_t LINEAR_MAX = 8;
+
+  if (nFields <= LINEAR_MAX) {
+    for (const Shape* shape = this; shape->parent != nullptr;
+         shape = shape->parent) {
+      if (shape->name == name)
+        return shape->nFields - 1;
+    }
+    return std::nullopt;
+  }
+  if (indexes.empty()) {
+    for (const Shape* shape = this; shape->parent != nullptr;
+         shape = shape->parent)
+      indexes.emplace(shape->name, shape->nFields - 1);
+  }
+  auto it = indexes.find(name);
+  if (it == indexes.end())
+    return std::nullopt;
+  return it->second;
+}
+
+const Shape* Shape::with(Symbol name) const {
+  std::unique_ptr<Shape>& child = transitions[name];
+
+  if (child == nullptr)
+    child.reset(new Shape(this, name));
+  return child.get();
+}
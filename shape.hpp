@@ -0,0 +1,42 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+
+#include "symbol.hpp"
+#include "uncopyable.hpp"
+
+// the layout of the fields of instances, shared by every instance that
+// got the same fields in the same order. Adding a field moves an instance
+// to a child shape, kept in the transitions of its parent so each is
+// created once. Shapes are never freed
+class Shape : public Uncopyable {
+ private:
+  // nullptr for the empty shape
+  const Shape* const parent;
+  // of the last field
+  const Symbol name;
+  const std::size_t nFields;
+  mutable std::unordered_map<Symbol, std::unique_ptr<Shape>> transitions;
+  // from names to indexes, built on the first lookup in a large shape
+  mutable std::unordered_map<Symbol, std::size_t> indexes;
+
+  Shape(const Shape* parent, Symbol name);
+
+ public:
+  static const Shape* empty();
+
+  std::size_t size() const { return nFields; }
+  std::optional<std::size_t> find(Symbol name) const;
+  // the shape with name added as the last field
+  const Shape* with(Symbol name) const;
+
+  // calls f(name, index) for every field, from the last
+  template <typename F>
+  void forEach(F f) const {
+    for (const Shape* shape = this; shape->parent != nullptr;
+         shape = shape->parent)
+      f(shape->name, shape->nFields - 1);
+  }
+};
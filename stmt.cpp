@@ -17,7 +17,7 @@ void StmtPrint::accept(StmtVisitor& v) const {
 }
 
 StmtVar::StmtVar(Token token, std::shared_ptr<const Expr> exprp)
-    : token(token), exprp(exprp) {}
+    : token(token), exprp(exprp), local(std::nullopt) {}
 
 void StmtVar::accept(StmtVisitor& v) const {
   v.visit(*this);
@@ -66,7 +66,7 @@ void StmtLoopFlow::accept(StmtVisitor& v) const {
 StmtFun::StmtFun(Token token,
                  std::list<Token> params,
                  std::unique_ptr<const StmtList>&& listp)
-    : Functional(params, std::move(listp)), token(token) {}
+    : Functional(params, std::move(listp)), token(token), local(std::nullopt) {}
 
 void StmtFun::accept(StmtVisitor& v) const {
   v.visit(std::static_pointer_cast<const StmtFun>(shared_from_this()));
@@ -81,7 +81,9 @@ StmtClass::StmtClass(Token token,
       superExpr(std::move(superExpr)),
       ctor(ctor),
       methods(std::move(methods)),
-      staticMethods(std::move(staticMethods)) {}
+      staticMethods(std::move(staticMethods)),
+      local(std::nullopt),
+      superLocal(std::nullopt) {}
 
 void StmtClass::accept(StmtVisitor& v) const {
   v.visit(*this);
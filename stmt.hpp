@@ -1,9 +1,11 @@
 #pragma once
 #include <list>
 #include <memory>
+#include <optional>
 
 #include "expr_fwd.hpp"
 #include "functional.hpp"
+#include "local.hpp"
 #include "stmt_visitor_fwd.hpp"
 #include "token.hpp"
 #include "uncopyable.hpp"
@@ -42,6 +44,8 @@ struct StmtPrint : public Stmt {
 struct StmtVar : public Stmt {
   const Token token;
   std::shared_ptr<const Expr> exprp;
+  // filled in by Resolver
+  mutable std::optional<Local> local;
 
   StmtVar(Token token, std::shared_ptr<const Expr> exprp);
 
@@ -113,6 +117,8 @@ struct StmtReturn : public Stmt {
 
 struct StmtFun : public Stmt, public Functional {
   const Token token;
+  // filled in by Resolver
+  mutable std::optional<Local> local;
 
   StmtFun(Token token,
           std::list<Token> params,
@@ -128,6 +134,10 @@ struct StmtClass : public Stmt {
   const std::shared_ptr<const StmtFun> ctor;
   const std::list<std::shared_ptr<const StmtFun>> methods;
   const std::list<std::shared_ptr<const StmtFun>> staticMethods;
+  // filled in by Resolver
+  mutable std::optional<Local> local;
+  // subclasses only
+  mutable std::optional<Local> superLocal;
 
   StmtClass(Token token,
             std::shared_ptr<const ExprVar>&& superExpr,
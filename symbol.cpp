@@ -0,0 +1,42 @@
+#include <cassert>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "symbol.hpp"
+
+namespace {
+struct Table {
+  // a deque, so the keys of symbols stay put as it grows
+  std::deque<std::string> names;
+  std::unordered_map<std::string_view, Symbol> symbols;
+
+  Table() : names{""}, symbols{{names.front(), Symbols::NONE}} {}
+};
+
+Table& table() {
+  static Table table;
+
+  return table;
+}
+}  // namespace
+
+Symbol Symbols::intern(std::string_view name) {
+  Table& t = table();
+
+  auto it = t.symbols.find(name);
+  if (it != t.symbols.end())
+    return it->second;
+  t.names.emplace_back(name);
+  return t.symbols
+      .emplace(t.names.back(), static_cast<Symbol>(t.names.size() - 1))
+      .first->second;
+}
+
+const std::string& Symbols::name(Symbol symbol) {
+  Table& t = table();
+
+  assert(symbol < t.names.size());
+  return t.names[symbol];
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// an interned identifier. The scanner interns every name once, so tables
+// of names are keyed by integers and compare without touching strings
+using Symbol = std::uint32_t;
+
+// the process wide table of symbols. Symbols are never freed, and only
+// the thread running the program may use the table
+class Symbols {
+ public:
+  // of tokens that are not names
+  static constexpr Symbol NONE = 0;
+
+  // the symbol of name, added if new
+  static Symbol intern(std::string_view name);
+  static const std::string& name(Symbol symbol);
+};
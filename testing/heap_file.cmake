@@ -0,0 +1,33 @@
+# runs LOX with the options in ARGS on SCRIPT, expecting exit code EXIT,
+# then checks that the interpreter wrote FILE. If set:
+# - OUTPUT must match what the script printed
+# - the number at KEY in the JSON in FILE must be between MIN and MAX
+# - the JSON in FILE must have at least MIN_LENGTH entries
+file(REMOVE "${FILE}")
+separate_arguments(args UNIX_COMMAND "${ARGS}")
+execute_process(COMMAND "${LOX}" ${args} "${SCRIPT}"
+                RESULT_VARIABLE result
+                OUTPUT_VARIABLE output
+                ERROR_VARIABLE output)
+if (NOT result EQUAL EXIT)
+  message(FATAL_ERROR "exit code ${result}, expected ${EXIT}:\n${output}")
+endif()
+if (DEFINED OUTPUT AND NOT output MATCHES "${OUTPUT}")
+  message(FATAL_ERROR "output does not match '${OUTPUT}':\n${output}")
+endif()
+if (NOT EXISTS "${FILE}")
+  message(FATAL_ERROR "${FILE} not written:\n${output}")
+endif()
+file(READ "${FILE}" json)
+if (DEFINED KEY)
+  string(JSON value GET "${json}" ${KEY})
+  if (value LESS MIN OR value GREATER MAX)
+    message(FATAL_ERROR "${KEY} is ${value}, expected ${MIN} to ${MAX}")
+  endif()
+endif()
+if (DEFINED MIN_LENGTH)
+  string(JSON length LENGTH "${json}")
+  if (length LESS MIN_LENGTH)
+    message(FATAL_ERROR "${length} entries, expected ${MIN_LENGTH} or more")
+  endif()
+endif()
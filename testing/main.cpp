@@ -144,7 +144,9 @@ static const std::string notPrefixes[] = {
   return results;
 }
 
-[[nodiscard]] int traverseDir(std::string binPath, fs::directory_entry dir) {
+[[nodiscard]] int traverseDir(std::string binPath,
+                              fs::directory_entry dir,
+                              std::string opts) {
   int ret;
 
   std::size_t numFails, numSuccesses;
@@ -179,7 +181,7 @@ static const std::string notPrefixes[] = {
       std::cout << str << ": no expects\n";
       continue;
     }
-    cmd = binPath + " " + str + " 2>&1";
+    cmd = binPath + opts + " " + str + " 2>&1";
     if ((results = getResults(cmd)).empty()) {
       numNoResults++;
       std::cout << str << ": no results\n";
@@ -209,9 +211,13 @@ int main(int argc, char* argv[]) {
 
   fs::directory_entry bin;
   fs::directory_entry dir;
+  std::string opts;
 
-  if (argc != 3)
+  if (argc < 3)
     err(1, "argc = " + std::to_string(argc));
+  // passed on to the interpreter
+  for (int i = 3; i < argc; i++)
+    opts += std::string(" ") + argv[i];
 
   bin = fs::directory_entry(fs::path(argv[1]));
   if (!fs::exists(bin))
@@ -227,7 +233,7 @@ int main(int argc, char* argv[]) {
   if (!fs::is_directory(dir))
     err(2, dir.path().string() + " is not a directory");
   try {
-    ret = traverseDir(bin.path().string(), dir);
+    ret = traverseDir(bin.path().string(), dir, opts);
   } catch (std::runtime_error& e) {
     std::cerr << "error: " << e.what() << '\n';
     ret = 2;
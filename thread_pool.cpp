@@ -0,0 +1,59 @@
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include "thread_pool.hpp"
+
+ThreadPool::ThreadPool(std::size_t nThreads)
+    : threads{},
+      jobp(nullptr),
+      generation(0),
+      nRunning(0),
+      isStopping(0) {
+  for (std::size_t i = 1; i < nThreads; i++)
+    threads.emplace_back(&ThreadPool::work, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    isStopping = 1;
+  }
+  wake.notify_all();
+  for (std::thread& thread : threads)
+    thread.join();
+}
+
+void ThreadPool::work(std::size_t index) {
+  std::size_t seen = 0;
+
+  while (1) {
+    std::unique_lock<std::mutex> guard(lock);
+    wake.wait(guard, [&] { return isStopping || generation != seen; });
+    if (isStopping)
+      return;
+    seen = generation;
+    guard.unlock();
+
+    (*jobp)(index);
+
+    guard.lock();
+    if (--nRunning == 0)
+      done.notify_one();
+  }
+}
+
+void ThreadPool::run(const std::function<void(std::size_t)>& job) {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    jobp = &job;
+    nRunning = threads.size();
+    generation++;
+  }
+  wake.notify_all();
+  job(0);
+
+  std::unique_lock<std::mutex> guard(lock);
+  done.wait(guard, [&] { return nRunning == 0; });
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "uncopyable.hpp"
+
+// a fixed set of threads running the same job together, the calling
+// thread included. Threads sleep between jobs
+class ThreadPool : public Uncopyable {
+ private:
+  std::vector<std::thread> threads;
+  std::mutex lock;
+  std::condition_variable wake;
+  std::condition_variable done;
+  const std::function<void(std::size_t)>* jobp;
+  // counts jobs, threads wait for the next one
+  std::size_t generation;
+  // threads still running the current job, the calling one excluded
+  std::size_t nRunning;
+  bool isStopping;
+
+  void work(std::size_t index);
+
+ public:
+  explicit ThreadPool(std::size_t nThreads);
+  ~ThreadPool();
+
+  std::size_t size() const { return threads.size() + 1; }
+  // calls job(index) on every thread, the calling one with index 0.
+  // Returns once every call returned
+  void run(const std::function<void(std::size_t)>& job);
+};
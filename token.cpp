@@ -1,6 +1,7 @@
 #include <string>
 
 #include "ltype.hpp"
+#include "symbol.hpp"
 
 #include "token.hpp"
 
@@ -9,8 +10,13 @@ using enum Token::Type;
 Token::Token(Token::Type type,
              std::string lexeme,
              Literal literal,
-             std::size_t lineNum)
-    : type(type), lexeme(lexeme), literal(literal), lineNum(lineNum) {}
+             std::size_t lineNum,
+             Symbol symbol)
+    : type(type),
+      lexeme(lexeme),
+      symbol(symbol),
+      literal(literal),
+      lineNum(lineNum) {}
 
 Token::operator std::string() const {
   static const char* t[] = {
@@ -34,9 +40,9 @@ Token::operator std::string() const {
 }
 
 bool Token::operator==(const Token& rhs) const {
-  return lexeme == rhs.lexeme;
+  return symbol == rhs.symbol;
 }
 
 std::size_t Token::Hash::operator()(const Token& token) const noexcept {
-  return std::hash<std::string>()(token.lexeme);
+  return std::hash<Symbol>()(token.symbol);
 }
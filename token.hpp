@@ -2,6 +2,7 @@
 #include <string>
 
 #include "ltype.hpp"
+#include "symbol.hpp"
 
 struct Token {
   enum class Type : unsigned int {
@@ -19,13 +20,16 @@ struct Token {
     CONTINUE, BREAK, PERCENT
   } type;
   std::string lexeme;
+  // of the name, interned by the scanner, NONE if not a name
+  Symbol symbol;
   Literal literal;
   std::size_t lineNum;
 
   Token(Token::Type type,
         std::string lexeme,
         Literal literal,
-        std::size_t lineNum);
+        std::size_t lineNum,
+        Symbol symbol = Symbols::NONE);
   Token() = delete;
   operator std::string() const;
 
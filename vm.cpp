@@ -0,0 +1,361 @@
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <list>
+#include <optional>
+#include <vector>
+
+#include "chunk.hpp"
+#include "func.hpp"
+#include "interp.hpp"
+#include "ltype.hpp"
+#include "stmt.hpp"
+#include "token.hpp"
+
+#include "vm.hpp"
+
+Vm::Vm(Interp& interp) : interp(interp) {}
+
+Ltype Vm::run(const Chunk& chunk) {
+  std::vector<Ltype>& stack = interp.operands;
+  const std::uint8_t* code;
+  std::size_t ip, start, idx, argc;
+  Ltype left, right, obj;
+
+  code = chunk.code.data();
+
+  auto readByte = [&]() -> std::size_t { return code[ip++]; };
+  auto readShort = [&]() -> std::size_t {
+    ip += 2;
+    return code[ip - 2] | (std::size_t)code[ip - 1] << 8;
+  };
+  // of the current instruction, only looked up on errors
+  auto token = [&]() -> const Token& { return chunk.tokenAt(start); };
+  auto value = [&](const std::optional<Ltype>& var) -> Ltype {
+    if (!var.has_value())
+      throw Interp::RuntimeError(token(), "uninitialized variable");
+    return var.value();
+  };
+  auto global = [&]() -> std::optional<Ltype>& {
+    auto it = interp.globals.find(chunk.names[readShort()]);
+    if (it == interp.globals.end())
+      throw Interp::RuntimeError(token(), "undeclared variable");
+    return it->second;
+  };
+  // pops right, leaves left on top to be replaced by the result
+  auto binary = [&]() -> void {
+    right = stack.back();
+    stack.pop_back();
+    left = stack.back();
+  };
+  auto numbers = [&]() -> void {
+    binary();
+    if (!left.is<double>() || !right.is<double>())
+      interp.checkNumberOperands(token(), left, right);
+  };
+
+  for (ip = 0;;) {
+    start = ip;
+    switch (static_cast<Op>(code[ip++])) {
+      case Op::CONSTANT:
+        stack.push_back(chunk.constants[readShort()]);
+        break;
+      case Op::NIL:
+        stack.push_back(Lnil());
+        break;
+      case Op::POP:
+        stack.pop_back();
+        break;
+
+      case Op::GET_LOCAL:
+        stack.push_back(value(interp.slot(readShort()).value));
+        break;
+      case Op::SET_LOCAL:
+        interp.slot(readShort()).value = stack.back();
+        break;
+      case Op::GET_CELL:
+        stack.push_back(value(interp.cell(readShort())));
+        break;
+      case Op::SET_CELL:
+        interp.setCell(readShort(), stack.back());
+        break;
+      case Op::GET_UPVALUE:
+        stack.push_back(value(interp.upvalue(readShort())));
+        break;
+      case Op::SET_UPVALUE:
+        interp.setUpvalue(readShort(), stack.back());
+        break;
+      case Op::GET_GLOBAL:
+        stack.push_back(value(global()));
+        break;
+      case Op::SET_GLOBAL:
+        global() = stack.back();
+        break;
+      case Op::DECLARE_LOCAL:
+        interp.slot(readShort()).value = std::nullopt;
+        break;
+      case Op::DECLARE_CELL: {
+        // a fresh cell each time, closures created by earlier executions
+        // keep theirs
+        Interp::Cell* cell = interp.doAlloc<Interp::Cell>(std::nullopt);
+        interp.slot(readShort()).cell = cell;
+        break;
+      }
+      case Op::DECLARE_GLOBAL:
+        // allow redeclaring in global -- for REPL
+        interp.globals[chunk.names[readShort()]] = std::nullopt;
+        break;
+
+      case Op::ADD:
+        binary();
+        if (left.is<double>() && right.is<double>()) {
+          stack.back() = left.get<double>() + right.get<double>();
+        } else if (left.is<StrPtr>() && right.is<StrPtr>()) {
+          // left is still on the stack, right is referenced by left
+          // or reachable from where it was loaded
+          Interp::RootScope scope(interp);
+
+          scope.add(right);
+          stack.back() =
+              interp.concat(scope, left.get<StrPtr>(), right.get<StrPtr>());
+        } else {
+          throw Interp::RuntimeError(
+              token(), "operands must be numbers or strings, got: " +
+                           typeToString(left) + ", " + typeToString(right));
+        }
+        break;
+      case Op::SUBTRACT:
+        numbers();
+        stack.back() = left.get<double>() - right.get<double>();
+        break;
+      case Op::MULTIPLY:
+        numbers();
+        stack.back() = left.get<double>() * right.get<double>();
+        break;
+      case Op::DIVIDE:
+        numbers();
+        if (interp.floatEquality(right.get<double>(), 0.0))
+          throw Interp::RuntimeError(token(), "division by zero");
+        stack.back() = left.get<double>() / right.get<double>();
+        break;
+      case Op::MODULO:
+        numbers();
+        if (interp.floatEquality(right.get<double>(), 0.0))
+          throw Interp::RuntimeError(token(), "division by zero");
+        stack.back() = std::fmod(left.get<double>(), right.get<double>());
+        break;
+      case Op::EQUAL:
+        binary();
+        stack.back() = interp.equality(left, right);
+        break;
+      case Op::NOT_EQUAL:
+        binary();
+        stack.back() = !interp.equality(left, right);
+        break;
+      case Op::LESS:
+        numbers();
+        stack.back() = left.get<double>() < right.get<double>();
+        break;
+      case Op::LESS_EQUAL:
+        numbers();
+        stack.back() = left.get<double>() <= right.get<double>();
+        break;
+      case Op::GREATER:
+        numbers();
+        stack.back() = left.get<double>() > right.get<double>();
+        break;
+      case Op::GREATER_EQUAL:
+        numbers();
+        stack.back() = left.get<double>() >= right.get<double>();
+        break;
+      case Op::NEGATE:
+        if (!stack.back().is<double>())
+          interp.checkNumberOperands(token(), stack.back());
+        stack.back() = -stack.back().get<double>();
+        break;
+      case Op::NOT:
+        stack.back() = !interp.isTruthful(stack.back());
+        break;
+
+      case Op::PRINT:
+        std::cout << valueToString(stack.back()) << '\n';
+        stack.pop_back();
+        break;
+
+      case Op::JUMP:
+        idx = readShort();
+        ip += idx;
+        break;
+      case Op::JUMP_IF_FALSE:
+        idx = readShort();
+        if (!interp.isTruthful(stack.back()))
+          ip += idx;
+        stack.pop_back();
+        break;
+      case Op::JUMP_IF_FALSE_OR_POP:
+        idx = readShort();
+        if (!interp.isTruthful(stack.back()))
+          ip += idx;
+        else
+          stack.pop_back();
+        break;
+      case Op::JUMP_IF_TRUE_OR_POP:
+        idx = readShort();
+        if (interp.isTruthful(stack.back()))
+          ip += idx;
+        else
+          stack.pop_back();
+        break;
+      case Op::LOOP:
+        idx = readShort();
+        ip -= idx;
+        break;
+
+      case Op::CHECK_CALL:
+        argc = readByte();
+        obj = stack.back();
+        if (!obj.isCallable() || obj.getCallable()->arity != argc)
+          interp.checkCallable(token(), obj, argc);
+        break;
+      case Op::CALL: {
+        std::size_t base;
+
+        argc = readByte();
+        base = stack.size() - argc;
+        obj = stack[base - 1];
+        // user functions read the arguments in place
+        if (obj.is<LfunPtr>())
+          obj = obj.get<LfunPtr>()->call(interp, stack.data() + base);
+        else
+          obj = obj.getCallable()->call(
+              interp,
+              std::list<Ltype>(stack.cbegin() + (std::ptrdiff_t)base,
+                               stack.cend()));
+        stack.resize(base);
+        stack.back() = obj;
+        break;
+      }
+      case Op::GET_METHOD: {
+        const PropertyCache::Entry* entry;
+        std::optional<Ltype> ret;
+
+        idx = readShort();
+        PropertyCache& cache = chunk.caches[readShort()];
+        obj = stack.back();
+        if (obj.is<InstPtr>() &&
+            (entry = interp.lookupProperty(chunk.names[idx],
+                                           obj.get<InstPtr>(), cache)) !=
+                nullptr &&
+            entry->kind == PropertyCache::Kind::METHOD) {
+          stack.back() = entry->method;
+          stack.push_back(obj);
+          break;
+        }
+        if ((ret = interp.getProperty(chunk.names[idx], obj, cache))
+                .has_value())
+          stack.back() = ret.value();
+        else
+          stack.back() = interp.getProperty(token(), obj);
+        stack.push_back(Lnil());
+        break;
+      }
+      case Op::CHECK_INVOKE:
+        argc = readByte();
+        obj = stack[stack.size() - 2];
+        if (stack.back().is<InstPtr>()) {
+          interp.checkArity(token(), obj.get<LfunPtr>(), argc);
+          break;
+        }
+        if (!obj.isCallable() || obj.getCallable()->arity != argc)
+          interp.checkCallable(token(), obj, argc);
+        break;
+      case Op::INVOKE: {
+        std::size_t base;
+
+        argc = readByte();
+        base = stack.size() - argc;
+        obj = stack[base - 2];
+        if (stack[base - 1].is<InstPtr>())
+          obj = obj.get<LfunPtr>()->call(
+              interp, stack[base - 1].get<InstPtr>(), stack.data() + base);
+        else if (obj.is<LfunPtr>())
+          obj = obj.get<LfunPtr>()->call(interp, stack.data() + base);
+        else
+          obj = obj.getCallable()->call(
+              interp,
+              std::list<Ltype>(stack.cbegin() + (std::ptrdiff_t)base,
+                               stack.cend()));
+        stack.resize(base - 1);
+        stack.back() = obj;
+        break;
+      }
+      case Op::RETURN:
+        obj = stack.back();
+        stack.pop_back();
+        return obj;
+      case Op::CLOSURE: {
+        Interp::RootScope scope(interp);
+
+        stack.push_back(
+            interp.closure(scope, chunk.functions[readShort()], false));
+        break;
+      }
+      case Op::CLASS: {
+        const StmtClass& stmt = *chunk.classes[readShort()];
+
+        if (stmt.superExpr == nullptr) {
+          interp.defineClass(stmt, std::nullopt);
+        } else {
+          interp.defineClass(stmt, stack.back());
+          stack.pop_back();
+        }
+        break;
+      }
+      case Op::GET_PROPERTY: {
+        std::optional<Ltype> ret;
+
+        idx = readShort();
+        obj = stack.back();
+        // the common case without looking up the token, the rest also
+        // reports errors
+        if ((ret = interp.getProperty(chunk.names[idx], obj,
+                                      chunk.caches[readShort()]))
+                .has_value())
+          stack.back() = ret.value();
+        else
+          stack.back() = interp.getProperty(token(), obj);
+        break;
+      }
+      case Op::CHECK_INSTANCE:
+        if (!stack.back().is<InstPtr>())
+          throw Interp::RuntimeError(token(),
+                                     "only class instances have fields");
+        break;
+      case Op::SET_PROPERTY:
+        binary();
+        idx = readShort();
+        interp.setProperty(left.get<InstPtr>(), chunk.names[idx], right,
+                           chunk.caches[readShort()]);
+        stack.back() = right;
+        break;
+      case Op::GET_SUPER: {
+        InstPtr receiver;
+
+        receiver = nullptr;
+        // stays on the stack while binding
+        if (readByte()) {
+          receiver = stack.back().get<InstPtr>();
+          obj = stack[stack.size() - 2];
+        } else {
+          obj = stack.back();
+        }
+        obj = interp.getSuper(token(), obj.get<ClassPtr>(), receiver);
+        if (receiver != nullptr)
+          stack.pop_back();
+        stack.back() = obj;
+        break;
+      }
+    }
+  }
+}
@@ -0,0 +1,19 @@
+#pragma once
+#include "chunk.hpp"
+#include "interp.hpp"
+#include "ltype.hpp"
+#include "uncopyable.hpp"
+
+// runs bytecode from Compiler. Variables live in the frames of the Interp,
+// temporaries on its operand stack, so bytecode, natives and classes can
+// call each other and share the collector
+class Vm : public Uncopyable {
+ private:
+  Interp& interp;
+
+ public:
+  Vm(Interp& interp);
+
+  // runs chunk in the current frame, returns the value of its RETURN
+  Ltype run(const Chunk& chunk);
+};